@@ -0,0 +1,557 @@
+/*
+ * (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * Author: Jose M. Guisado <jguisado@soleta.eu>
+ */
+
+
+#include <limits.h>
+
+#include "fdisk.h"
+
+/* Python logging levels */
+#define LOG_DEBUG	10
+#define LOG_INFO	20
+#define LOG_WARNING	30
+#define LOG_DISABLED	INT_MAX
+
+#define LOG_FLUSH_BATCH	32
+
+void log_init(ModuleState *st)
+{
+	pthread_mutex_init(&st->log.lock, NULL);
+	st->log.threshold = LOG_DISABLED;
+}
+
+void log_destroy(ModuleState *st)
+{
+	pthread_mutex_destroy(&st->log.lock);
+}
+
+static int log_enabled(ModuleState *st, int level)
+{
+	return level >= __atomic_load_n(&st->log.threshold, __ATOMIC_RELAXED);
+}
+
+/* Queue a message. Callers check log_enabled() first to skip formatting. */
+static void log_push(ModuleState *st, int level, const char *mesg, int err)
+{
+	struct log_ring *r = &st->log;
+	struct log_entry *e;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->count == LOG_RING_SIZE) {
+		r->dropped++;
+		pthread_mutex_unlock(&r->lock);
+		return;
+	}
+	e = &r->entries[(r->head + r->count) % LOG_RING_SIZE];
+	e->level = level;
+	if (err)
+		snprintf(e->msg, sizeof(e->msg), "%s: %s", mesg ? mesg : "", strerror(err));
+	else
+		snprintf(e->msg, sizeof(e->msg), "%s", mesg ? mesg : "");
+	__atomic_store_n(&r->count, r->count + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * The current logger, or NULL. set_debug() may replace it from another
+ * thread on free-threaded builds, so callers get a strong reference.
+ */
+static PyObject *log_get_logger(ModuleState *st)
+{
+	PyObject *logger;
+
+	pthread_mutex_lock(&st->log.lock);
+	logger = Py_XNewRef(st->logger);
+	pthread_mutex_unlock(&st->log.lock);
+
+	return logger;
+}
+
+/*
+ * Refresh the cached logger threshold, so messages below the logger's
+ * effective level are never queued. Needs the GIL.
+ */
+static int log_update_threshold(ModuleState *st, PyObject *logger)
+{
+	int threshold = LOG_DISABLED;
+	PyObject *lvl;
+
+	if (logger) {
+		lvl = PyObject_CallMethod(logger, "getEffectiveLevel", NULL);
+		if (!lvl)
+			return -1;
+		threshold = PyLong_AsLong(lvl);
+		Py_DECREF(lvl);
+		if (threshold == -1 && PyErr_Occurred())
+			return -1;
+	}
+	__atomic_store_n(&st->log.threshold, threshold, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/*
+ * Pass all queued messages to the logger, LOG_FLUSH_BATCH at a time.
+ * Needs the GIL. Any pending exception is preserved; errors raised by the
+ * logger are reported as unraisable.
+ */
+void log_flush(ModuleState *st)
+{
+	struct log_entry batch[LOG_FLUSH_BATCH];
+	struct log_ring *r = &st->log;
+	PyObject *type, *value, *tb, *res, *logger;
+	unsigned long dropped;
+	unsigned int i, n;
+
+	PyErr_Fetch(&type, &value, &tb);
+	logger = log_get_logger(st);
+
+	do {
+		pthread_mutex_lock(&r->lock);
+		for (n = 0; n < LOG_FLUSH_BATCH && r->count; n++) {
+			batch[n] = r->entries[r->head];
+			r->head = (r->head + 1) % LOG_RING_SIZE;
+			r->count--;
+		}
+		dropped = r->dropped;
+		r->dropped = 0;
+		pthread_mutex_unlock(&r->lock);
+
+		for (i = 0; logger && i < n; i++) {
+			res = PyObject_CallMethod(logger, "log", "is",
+						  batch[i].level, batch[i].msg);
+			if (!res)
+				PyErr_WriteUnraisable(logger);
+			Py_XDECREF(res);
+		}
+		if (logger && dropped) {
+			res = PyObject_CallMethod(logger, "log", "isk", LOG_WARNING,
+						  "%d libfdisk messages dropped", dropped);
+			if (!res)
+				PyErr_WriteUnraisable(logger);
+			Py_XDECREF(res);
+		}
+	} while (n == LOG_FLUSH_BATCH);
+
+	if (log_update_threshold(st, logger) < 0)
+		PyErr_WriteUnraisable(logger);
+	Py_XDECREF(logger);
+
+	PyErr_Restore(type, value, tb);
+}
+
+static int answer_number(struct fdisk_ask *ask, struct ask_answer *a)
+{
+	uint64_t low = fdisk_ask_number_get_low(ask);
+	uint64_t high = fdisk_ask_number_get_high(ask);
+
+	switch (a->how) {
+	case ANSWER_UNSET:
+	case ANSWER_DEFAULT:
+		return fdisk_ask_number_set_result(ask, fdisk_ask_number_get_default(ask));
+	case ANSWER_LOW:
+		return fdisk_ask_number_set_result(ask, low);
+	case ANSWER_HIGH:
+		return fdisk_ask_number_set_result(ask, high);
+	case ANSWER_VALUE:
+		if (a->value < low || a->value > high)
+			return -ERANGE;
+		return fdisk_ask_number_set_result(ask, a->value);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int answer_yesno(struct fdisk_ask *ask, struct ask_answer *a)
+{
+	/* there is no default, "no" is the safe answer */
+	return fdisk_ask_yesno_set_result(ask, a->how == ANSWER_VALUE && a->value);
+}
+
+static int answer_string(struct fdisk_ask *ask, struct ask_answer *a)
+{
+	char *str;
+
+	if (a->how != ANSWER_STRING)
+		return -EINVAL;
+	str = strdup(a->string);
+	if (!str)
+		return -ENOMEM;
+	return fdisk_ask_string_set_result(ask, str);
+}
+
+static int answer_menu(struct fdisk_ask *ask, struct ask_answer *a)
+{
+	switch (a->how) {
+	case ANSWER_UNSET:
+	case ANSWER_DEFAULT:
+		return fdisk_ask_menu_set_result(ask, fdisk_ask_menu_get_default(ask));
+	case ANSWER_VALUE:
+		return fdisk_ask_menu_set_result(ask, (int) a->value);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Only use an override of the right kind, e.g. no number for a menu */
+static int answer_matches(int otype, int type)
+{
+	if (type == FDISK_ASKTYPE_OFFSET)
+		type = FDISK_ASKTYPE_NUMBER;
+	if (otype == FDISK_ASKTYPE_OFFSET)	/* plain 'default' */
+		return type == FDISK_ASKTYPE_NUMBER || type == FDISK_ASKTYPE_MENU;
+	return otype == type;
+}
+
+/* Answer a question from @answers alone: no GIL, no Python calls */
+static int answer_ask(struct ask_answers *answers, struct fdisk_ask *ask)
+{
+	const char *query = fdisk_ask_get_query(ask);
+	int type = fdisk_ask_get_type(ask);
+	struct ask_answer *a = NULL;
+	size_t i;
+
+	for (i = 0; query && i < answers->noverrides; i++) {
+		struct ask_override *o = &answers->overrides[i];
+
+		if (answer_matches(o->type, type) && strstr(query, o->query)) {
+			a = &o->answer;
+			break;
+		}
+	}
+
+	switch (type) {
+	case FDISK_ASKTYPE_NUMBER:
+	case FDISK_ASKTYPE_OFFSET:
+		return answer_number(ask, a ? a : &answers->number);
+	case FDISK_ASKTYPE_YESNO:
+		return answer_yesno(ask, a ? a : &answers->yesno);
+	case FDISK_ASKTYPE_STRING:
+		return answer_string(ask, a ? a : &answers->string);
+	case FDISK_ASKTYPE_MENU:
+		return answer_menu(ask, a ? a : &answers->menu);
+	default:
+		return -EINVAL;
+	}
+}
+
+/*
+ * libfdisk dialog handler installed on every context. fdisk_info() and
+ * fdisk_warn*() messages go to the logger set with fdisk.set_debug();
+ * they are only formatted if the logger would emit them. Questions are
+ * answered from Context.set_answers(), or fail without them.
+ */
+int Context_ask_cb(struct fdisk_context *cxt, struct fdisk_ask *ask, void *data)
+{
+	ContextObject *self = data;
+	ModuleState *st = self->st;
+
+	switch (fdisk_ask_get_type(ask)) {
+	case FDISK_ASKTYPE_INFO:
+		if (log_enabled(st, LOG_INFO))
+			log_push(st, LOG_INFO, fdisk_ask_print_get_mesg(ask), 0);
+		return 0;
+	case FDISK_ASKTYPE_WARNX:
+		if (log_enabled(st, LOG_WARNING))
+			log_push(st, LOG_WARNING, fdisk_ask_print_get_mesg(ask), 0);
+		return 0;
+	case FDISK_ASKTYPE_WARN:
+		if (log_enabled(st, LOG_WARNING))
+			log_push(st, LOG_WARNING, fdisk_ask_print_get_mesg(ask),
+				 fdisk_ask_print_get_errno(ask));
+		return 0;
+	default:
+		/* same as having no dialog handler at all */
+		if (!self->answers)
+			return -EINVAL;
+		return answer_ask(self->answers, ask);
+	}
+}
+
+static const char * const answer_kinds[] = {
+	[FDISK_ASKTYPE_NUMBER]	= "number",
+	[FDISK_ASKTYPE_YESNO]	= "yesno",
+	[FDISK_ASKTYPE_STRING]	= "string",
+	[FDISK_ASKTYPE_MENU]	= "menu",
+};
+
+/*
+ * Read the answer @obj to questions of @type (FDISK_ASKTYPE_NUMBER, _YESNO,
+ * _STRING or _MENU), so bad answers fail in set_answers() and not in the
+ * middle of an operation.
+ */
+static int answer_from_object(PyObject *obj, struct ask_answer *a, int type)
+{
+	const char *str = NULL;
+
+	if (PyUnicode_Check(obj) && !(str = PyUnicode_AsUTF8(obj)))
+		return -1;
+
+	switch (type) {
+	case FDISK_ASKTYPE_NUMBER:
+		if (PyLong_Check(obj) && !PyBool_Check(obj)) {
+			a->value = PyLong_AsUnsignedLongLong(obj);
+			if (a->value == (uint64_t) -1 && PyErr_Occurred())
+				return -1;
+			a->how = ANSWER_VALUE;
+		} else if (str && !strcmp(str, "default")) {
+			a->how = ANSWER_DEFAULT;
+		} else if (str && !strcmp(str, "low")) {
+			a->how = ANSWER_LOW;
+		} else if (str && !strcmp(str, "high")) {
+			a->how = ANSWER_HIGH;
+		} else {
+			goto err;
+		}
+		return 0;
+	case FDISK_ASKTYPE_YESNO:
+		if (PyBool_Check(obj))
+			a->value = obj == Py_True;
+		else if (str && (!strcmp(str, "yes") || !strcmp(str, "no")))
+			a->value = str[0] == 'y';
+		else
+			goto err;
+		a->how = ANSWER_VALUE;
+		return 0;
+	case FDISK_ASKTYPE_MENU:
+		if (str && !strcmp(str, "default")) {
+			a->how = ANSWER_DEFAULT;
+		} else if (str && strlen(str) == 1) {
+			/* menu keys are characters, e.g. 'p' for a primary partition */
+			a->value = (unsigned char) str[0];
+			a->how = ANSWER_VALUE;
+		} else {
+			goto err;
+		}
+		return 0;
+	case FDISK_ASKTYPE_STRING:
+		if (!str)
+			goto err;
+		if (!(a->string = strdup(str))) {
+			PyErr_NoMemory();
+			return -1;
+		}
+		a->how = ANSWER_STRING;
+		return 0;
+	}
+err:
+	PyErr_Format(PyExc_ValueError, "invalid %s answer %R", answer_kinds[type], obj);
+	return -1;
+}
+
+/*
+ * A 'queries' answer: (kind, value) for any kind, or a plain value whose
+ * kind is unambiguous. 'default' is stored as an OFFSET answer, which
+ * answer_ask() uses for numbers and menus alike.
+ */
+static int answer_override_from_object(PyObject *obj, struct ask_override *o)
+{
+	const char *str;
+	int type;
+
+	if (PyTuple_Check(obj) && PyTuple_GET_SIZE(obj) == 2 &&
+	    PyUnicode_Check(PyTuple_GET_ITEM(obj, 0))) {
+		for (type = 0; type < (int) (sizeof(answer_kinds) / sizeof(answer_kinds[0])); type++) {
+			if (answer_kinds[type] &&
+			    PyUnicode_CompareWithASCIIString(PyTuple_GET_ITEM(obj, 0),
+							     answer_kinds[type]) == 0) {
+				o->type = type;
+				return answer_from_object(PyTuple_GET_ITEM(obj, 1), &o->answer, type);
+			}
+		}
+	} else if (PyBool_Check(obj)) {
+		o->type = FDISK_ASKTYPE_YESNO;
+		return answer_from_object(obj, &o->answer, o->type);
+	} else if (PyLong_Check(obj)) {
+		o->type = FDISK_ASKTYPE_NUMBER;
+		return answer_from_object(obj, &o->answer, o->type);
+	} else if (PyUnicode_Check(obj)) {
+		if (!(str = PyUnicode_AsUTF8(obj)))
+			return -1;
+		if (!strcmp(str, "default")) {
+			o->type = FDISK_ASKTYPE_OFFSET;
+			o->answer.how = ANSWER_DEFAULT;
+			return 0;
+		}
+		if (!strcmp(str, "low") || !strcmp(str, "high")) {
+			o->type = FDISK_ASKTYPE_NUMBER;
+			return answer_from_object(obj, &o->answer, o->type);
+		}
+	}
+
+	PyErr_Format(PyExc_ValueError,
+		     "ambiguous answer %R for query '%s', use (kind, value) with "
+		     "kind 'number', 'yesno', 'string' or 'menu'", obj, o->query);
+	return -1;
+}
+
+static int answers_overrides_from_object(PyObject *obj, struct ask_answers *answers)
+{
+	PyObject *key, *value;
+	Py_ssize_t pos = 0;
+	const char *query;
+
+	if (!PyDict_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError, "'queries' must be a dict");
+		return -1;
+	}
+	answers->overrides = calloc(PyDict_GET_SIZE(obj) ? PyDict_GET_SIZE(obj) : 1,
+				    sizeof(*answers->overrides));
+	if (!answers->overrides) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	while (PyDict_Next(obj, &pos, &key, &value)) {
+		struct ask_override *o = &answers->overrides[answers->noverrides];
+
+		if (!PyUnicode_Check(key) || !(query = PyUnicode_AsUTF8(key))) {
+			if (!PyErr_Occurred())
+				PyErr_SetString(PyExc_TypeError, "'queries' keys must be str");
+			return -1;
+		}
+		if (!(o->query = strdup(query))) {
+			PyErr_NoMemory();
+			return -1;
+		}
+		answers->noverrides++;
+		if (answer_override_from_object(value, o) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+void answers_free(struct ask_answers *answers)
+{
+	size_t i;
+
+	if (!answers)
+		return;
+	for (i = 0; i < answers->noverrides; i++) {
+		free(answers->overrides[i].query);
+		free(answers->overrides[i].answer.string);
+	}
+	free(answers->overrides);
+	free(answers->yesno.string);
+	free(answers->number.string);
+	free(answers->string.string);
+	free(answers->menu.string);
+	free(answers);
+}
+
+/*
+ * Build the answers for Context.set_answers() from a dict with optional
+ * keys 'yesno', 'number', 'string', 'menu' and 'queries'. Raises and
+ * returns NULL on invalid input.
+ */
+struct ask_answers *answers_from_object(PyObject *obj)
+{
+	static const char * const keys[] = { "yesno", "number", "string", "menu", NULL };
+	static const int types[] = { FDISK_ASKTYPE_YESNO, FDISK_ASKTYPE_NUMBER,
+				     FDISK_ASKTYPE_STRING, FDISK_ASKTYPE_MENU };
+	struct ask_answers *answers;
+	struct ask_answer *slots[4];
+	PyObject *key, *value;
+	Py_ssize_t pos = 0;
+	int i;
+
+	if (!PyDict_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError, "answers must be a dict");
+		return NULL;
+	}
+	answers = calloc(1, sizeof(*answers));
+	if (!answers)
+		return (struct ask_answers *) PyErr_NoMemory();
+	slots[0] = &answers->yesno;
+	slots[1] = &answers->number;
+	slots[2] = &answers->string;
+	slots[3] = &answers->menu;
+
+	while (PyDict_Next(obj, &pos, &key, &value)) {
+		if (PyUnicode_Check(key) &&
+		    PyUnicode_CompareWithASCIIString(key, "queries") == 0) {
+			if (answers_overrides_from_object(value, answers) < 0)
+				goto err;
+			continue;
+		}
+		for (i = 0; keys[i]; i++) {
+			if (PyUnicode_Check(key) &&
+			    PyUnicode_CompareWithASCIIString(key, keys[i]) == 0)
+				break;
+		}
+		if (!keys[i]) {
+			PyErr_Format(PyExc_ValueError, "unknown answer %R", key);
+			goto err;
+		}
+		if (answer_from_object(value, slots[i], types[i]) < 0)
+			goto err;
+	}
+	return answers;
+err:
+	answers_free(answers);
+	return NULL;
+}
+
+#define Fdisk_set_debug_HELP "set_debug(mask=0, logger=None)\n\n" \
+	"Send libfdisk informational and warning messages to logger, a " \
+	"logging.Logger (None to discard them). Messages below the logger's " \
+	"effective level are not even formatted; call set_debug() again after " \
+	"lowering the level. A non-zero mask enables libfdisk's internal debug " \
+	"output (see LIBFDISK_DEBUG), which libfdisk always writes to stderr " \
+	"and only honours if debugging was not initialized before."
+static PyObject *Fdisk_set_debug(PyObject *mod, PyObject *const *args,
+				 Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "mask", "logger", NULL };
+	ModuleState *st = get_module_state(mod);
+	PyObject *argv[2] = { NULL, NULL }, *logger, *old;
+	int mask = 0;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 2, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && (mask = PyLong_AsLong(argv[0])) == -1 && PyErr_Occurred())
+		return NULL;
+	logger = argv[1] && argv[1] != Py_None ? argv[1] : NULL;
+	if (logger && !PyObject_HasAttrString(logger, "log")) {
+		PyErr_SetString(PyExc_TypeError, "logger must be a logging.Logger");
+		return NULL;
+	}
+
+	/* deliver what was queued for the previous logger */
+	log_flush(st);
+
+	pthread_mutex_lock(&st->log.lock);
+	old = st->logger;
+	st->logger = Py_XNewRef(logger);
+	pthread_mutex_unlock(&st->log.lock);
+	Py_XDECREF(old);
+	if (log_update_threshold(st, logger) < 0)
+		return NULL;
+
+	if (mask)
+		fdisk_init_debug(mask);
+
+	Py_RETURN_NONE;
+}
+
+#define Fdisk_flush_log_HELP "flush_log()\n\n" \
+	"Pass queued libfdisk messages to the logger now. Context methods do " \
+	"this on return."
+static PyObject *Fdisk_flush_log(PyObject *mod, PyObject *Py_UNUSED(ignored))
+{
+	log_flush(get_module_state(mod));
+	Py_RETURN_NONE;
+}
+
+PyMethodDef Log_methods[] = {
+	{"set_debug",	(PyCFunction)(void(*)(void))Fdisk_set_debug, METH_FASTCALL | METH_KEYWORDS, Fdisk_set_debug_HELP},
+	{"flush_log",	(PyCFunction)Fdisk_flush_log, METH_NOARGS, Fdisk_flush_log_HELP},
+	{NULL}
+};
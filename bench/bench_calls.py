@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+#
+# (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+"""
+Per-call overhead micro-benchmarks for the fdisk bindings.
+
+Every case is a cheap binding call on an in-memory context backed by a
+sparse GPT image, so the timings are dominated by argument parsing and
+object construction rather than by disk I/O.
+
+    python3 bench/bench_calls.py [--json out.json]
+    python3 bench/bench_calls.py --compare before.json after.json
+
+Run it against two builds (e.g. with PYTHONPATH pointing at each) and
+compare the JSON outputs to see the per-call difference.
+"""
+
+import argparse
+import json
+import os
+import sys
+import tempfile
+import timeit
+
+GPT_LINUX = "0FC63DAF-8483-4772-8E79-3D69D8477DE4"
+
+
+def make_image(path, size=64 << 20, nparts=4):
+    import fdisk
+
+    with open(path, "wb") as f:
+        f.truncate(size)
+    cxt = fdisk.Context(path)
+    cxt.create_disklabel("gpt")
+    ptype = cxt.label.get_parttype_from_string(GPT_LINUX)
+    for _ in range(nparts):
+        pa = fdisk.Partition(partno_follow_default=True,
+                             start_follow_default=True)
+        pa.size = 2048
+        pa.type = ptype
+        cxt.add_partition(pa)
+    cxt.write_disklabel()
+
+
+def cases(path):
+    import fdisk
+
+    cxt = fdisk.Context(path, readonly=True)
+    label = cxt.label
+    pa = cxt.partitions[0]
+
+    return {
+        "Context()": lambda: fdisk.Context(),
+        "Context(details=False)": lambda: fdisk.Context(details=False),
+        "Partition()": lambda: fdisk.Partition(),
+        "Partition(kw)": lambda: fdisk.Partition(partno_follow_default=True),
+        "Label(cxt)": lambda: fdisk.Label(cxt),
+        "partition_to_string": lambda: cxt.partition_to_string(pa, fdisk.FDISK_FIELD_SIZE),
+        "get_parttype_from_string": lambda: label.get_parttype_from_string(GPT_LINUX),
+        "Partition.update": lambda: pa.update(name="x"),
+        "Partition.as_tuple": lambda: pa.as_tuple(("partno", "start", "size")),
+        "ctx.label": lambda: cxt.label,
+        "partition.type": lambda: pa.type,
+    }
+
+
+def run(number, repeat):
+    results = {}
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "calls.img")
+        make_image(path)
+        for name, fn in cases(path).items():
+            try:
+                fn()
+            except (AttributeError, TypeError):
+                # not available in this build
+                continue
+            best = min(timeit.repeat(fn, number=number, repeat=repeat))
+            results[name] = best / number * 1e9
+    return results
+
+
+def compare(before, after):
+    with open(before) as f:
+        a = json.load(f)["ns_per_call"]
+    with open(after) as f:
+        b = json.load(f)["ns_per_call"]
+    print("%-28s %10s %10s %8s" % ("case", "before", "after", "delta"))
+    for name in a:
+        if name not in b:
+            continue
+        print("%-28s %10.1f %10.1f %+7.1f%%" %
+              (name, a[name], b[name], (b[name] - a[name]) / a[name] * 100))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--number", type=int, default=20000)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("--json", metavar="FILE", help="write results as JSON")
+    parser.add_argument("--compare", nargs=2, metavar=("BEFORE", "AFTER"))
+    args = parser.parse_args()
+
+    if args.compare:
+        compare(*args.compare)
+        return 0
+
+    results = run(args.number, args.repeat)
+    for name, ns in results.items():
+        print("%-28s %10.1f ns/call" % (name, ns))
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"python": sys.version.split()[0],
+                       "ns_per_call": results}, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
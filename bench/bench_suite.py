@@ -0,0 +1,227 @@
+#!/usr/bin/env python3
+#
+# (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+"""
+Latency and throughput of the main fdisk binding operations.
+
+Every combination of label (dos, gpt), image size and partition count
+gets its own sparse image file, so no root, loop device or real disk is
+needed and results are comparable across machines. For each case the
+per-operation latencies are summarized (min, median, p95, p99, mean) and
+turned into operations per second.
+
+    python3 bench/bench_suite.py [--quick] [--json out.json]
+    python3 bench/bench_suite.py --compare before.json after.json [--threshold 10]
+
+--compare exits with status 1 if any operation got slower (median) by
+more than --threshold percent, so it can gate a change.
+"""
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import sys
+import tempfile
+import time
+
+import fdisk
+
+GPT_LINUX = "0FC63DAF-8483-4772-8E79-3D69D8477DE4"
+DOS_LINUX = 0x83
+FIELDS = ("FDISK_FIELD_DEVICE", "FDISK_FIELD_START", "FDISK_FIELD_END",
+          "FDISK_FIELD_SECTORS", "FDISK_FIELD_SIZE", "FDISK_FIELD_TYPE")
+UNITS = {"M": 1 << 20, "G": 1 << 30, "T": 1 << 40}
+
+
+def parse_size(s):
+    if s[-1].upper() in UNITS:
+        return int(s[:-1]) * UNITS[s[-1].upper()]
+    return int(s)
+
+
+def lookup(label, name):
+    if name == "dos":
+        return label.get_parttype_from_code(DOS_LINUX)
+    return label.get_parttype_from_string(GPT_LINUX)
+
+
+def populate(cxt, name, nparts, part_sectors):
+    """Add nparts partitions, returning the add_partition() latencies."""
+    ptype = lookup(cxt.label, name)
+    samples = []
+    for _ in range(nparts):
+        pa = fdisk.Partition(partno_follow_default=True,
+                             start_follow_default=True)
+        pa.size = part_sectors
+        pa.type = ptype
+        t = time.perf_counter_ns()
+        cxt.add_partition(pa)
+        samples.append(time.perf_counter_ns() - t)
+    return samples
+
+
+def make_image(path, name, size, nparts):
+    """Create a sparse image, returning add/write latencies while doing so."""
+    with open(path, "wb") as f:
+        f.truncate(size)
+    cxt = fdisk.Context(path)
+    cxt.create_disklabel(name)
+    # dos asks primary/extended even for follow-default partitions
+    cxt.set_answers({"menu": "p"})
+    add = populate(cxt, name, nparts, (size // 512 - 4096) // (nparts + 1))
+    t = time.perf_counter_ns()
+    cxt.write_disklabel()
+    return add, [time.perf_counter_ns() - t]
+
+
+def sample(fn, n):
+    out = []
+    for _ in range(n):
+        t = time.perf_counter_ns()
+        fn()
+        out.append(time.perf_counter_ns() - t)
+    return out
+
+
+def summarize(samples, ops_per_sample=1):
+    s = sorted(samples)
+    pick = lambda q: s[min(len(s) - 1, int(q * len(s)))]
+    median = statistics.median(s)
+    return {
+        "n": len(s),
+        "min_ns": s[0],
+        "median_ns": median,
+        "p95_ns": pick(0.95),
+        "p99_ns": pick(0.99),
+        "mean_ns": statistics.fmean(s),
+        "ops_per_s": ops_per_sample * 1e9 / median if median else None,
+    }
+
+
+def run_case(tmp, name, size, nparts, iterations):
+    path = os.path.join(tmp, "%s-%d-%d.img" % (name, size, nparts))
+    ops = {"add_partition": [], "write_disklabel": []}
+
+    # add/write are measured on fresh images, a few rounds of them
+    for _ in range(max(1, iterations // 50)):
+        add, write = make_image(path, name, size, nparts)
+        ops["add_partition"] += add
+        ops["write_disklabel"] += write
+
+    cxt = fdisk.Context(path, readonly=True)
+    parts = cxt.partitions
+    fields = [getattr(fdisk, f) for f in FIELDS if hasattr(fdisk, f)]
+    label = cxt.label
+
+    def to_string():
+        for pa in parts:
+            for field in fields:
+                cxt.partition_to_string(pa, field)
+
+    ops["Context()"] = sample(lambda: fdisk.Context(path, readonly=True), iterations)
+    ops["partitions"] = sample(lambda: cxt.partitions, iterations)
+    ops["partition_to_string"] = sample(to_string, iterations)
+    ops["parttype_lookup"] = sample(lambda: lookup(label, name), iterations)
+    os.unlink(path)
+
+    per_sample = {"partition_to_string": len(parts) * len(fields)}
+    return {
+        "label": name,
+        "size": size,
+        "nparts": len(parts),
+        "ops": {op: summarize(s, per_sample.get(op, 1)) for op, s in ops.items()},
+    }
+
+
+def run(labels, sizes, counts, iterations):
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        for name in labels:
+            # no extended/logical partitions for dos, primaries only; a set
+            # so clamped counts do not run (and key) the same case twice
+            ncases = sorted({min(n, 4) if name == "dos" else n for n in counts})
+            for size in sizes:
+                for n in ncases:
+                    case = run_case(tmp, name, size, n, iterations)
+                    results.append(case)
+                    for op, r in case["ops"].items():
+                        print("%-4s %7d MiB %3d parts  %-20s %10.0f ns  %12.0f op/s" %
+                              (name, size >> 20, case["nparts"], op,
+                               r["median_ns"], r["ops_per_s"]))
+    return results
+
+
+def case_key(case):
+    return "%s/%d/%d" % (case["label"], case["size"], case["nparts"])
+
+
+def compare(before, after, threshold):
+    with open(before) as f:
+        a = {case_key(c): c for c in json.load(f)["results"]}
+    with open(after) as f:
+        b = {case_key(c): c for c in json.load(f)["results"]}
+    regressions = 0
+    print("%-28s %-20s %12s %12s %8s" % ("case", "op", "before", "after", "delta"))
+    for key in a:
+        if key not in b:
+            continue
+        for op, ra in a[key]["ops"].items():
+            rb = b[key]["ops"].get(op)
+            if not rb or not ra["median_ns"]:
+                continue
+            delta = (rb["median_ns"] - ra["median_ns"]) / ra["median_ns"] * 100
+            flag = ""
+            if delta > threshold:
+                flag = "  REGRESSION"
+                regressions += 1
+            print("%-28s %-20s %12.0f %12.0f %+7.1f%%%s" %
+                  (key, op, ra["median_ns"], rb["median_ns"], delta, flag))
+    return 1 if regressions else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--labels", default="dos,gpt")
+    parser.add_argument("--sizes", default="64M,1G,64G",
+                        help="comma separated image sizes (default 64M,1G,64G)")
+    parser.add_argument("--parts", default="1,4,32",
+                        help="comma separated partition counts (default 1,4,32)")
+    parser.add_argument("--iterations", type=int, default=1000)
+    parser.add_argument("--quick", action="store_true",
+                        help="64M and 1G images, 1 and 4 partitions, 200 iterations")
+    parser.add_argument("--json", metavar="FILE", help="write results as JSON")
+    parser.add_argument("--compare", nargs=2, metavar=("BEFORE", "AFTER"))
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="percent slowdown reported as regression (default 10)")
+    args = parser.parse_args()
+
+    if args.compare:
+        return compare(*args.compare, args.threshold)
+
+    if args.quick:
+        args.sizes, args.parts, args.iterations = "64M,1G", "1,4", 200
+    results = run(args.labels.split(","),
+                  [parse_size(s) for s in args.sizes.split(",")],
+                  [int(n) for n in args.parts.split(",")],
+                  args.iterations)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"python": sys.version.split()[0],
+                       "machine": platform.machine(),
+                       "kernel": platform.release(),
+                       "iterations": args.iterations,
+                       "results": results}, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+"""
+Benchmark the add_partition()/write_disklabel() wipe modes.
+
+For every image size and wipe mode a fresh sparse GPT image is created
+and a single partition spanning the disk is added and written. On image
+files 'discard' punches a hole and 'zeroout' zeroes the range with
+fallocate(), which is what BLKDISCARD/BLKZEROOUT do for loop devices
+backed by such files; no root or loop device is needed.
+
+    python3 bench/bench_wipe.py [--sizes 1G,8G] [--repeat 3] [--json out.json]
+
+Note that 'zeroout' allocates (unwritten) extents for the whole image, so
+the filesystem holding --dir needs that much free space.
+"""
+
+import argparse
+import json
+import os
+import sys
+import tempfile
+import time
+
+import fdisk
+
+GPT_LINUX = "0FC63DAF-8483-4772-8E79-3D69D8477DE4"
+MODES = ("none", "signatures", "discard", "zeroout")
+UNITS = {"M": 1 << 20, "G": 1 << 30, "T": 1 << 40}
+
+
+def parse_size(s):
+    if s[-1].upper() in UNITS:
+        return int(s[:-1]) * UNITS[s[-1].upper()]
+    return int(s)
+
+
+def run_once(path, size, mode):
+    with open(path, "wb") as f:
+        f.truncate(size)
+    try:
+        start = time.perf_counter()
+        cxt = fdisk.Context(path)
+        cxt.create_disklabel("gpt")
+        pa = fdisk.Partition(partno_follow_default=True,
+                             start_follow_default=True,
+                             end_follow_default=True)
+        pa.type = cxt.label.get_parttype_from_string(GPT_LINUX)
+        cxt.add_partition(pa, wipe=mode)
+        cxt.write_disklabel()
+        return time.perf_counter() - start
+    finally:
+        os.unlink(path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--sizes", default="1G,8G",
+                        help="comma separated image sizes (default 1G,8G)")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--dir", default=None, help="where to create images")
+    parser.add_argument("--json", metavar="FILE", help="write results as JSON")
+    args = parser.parse_args()
+
+    results = []
+    with tempfile.TemporaryDirectory(dir=args.dir) as tmp:
+        path = os.path.join(tmp, "wipe.img")
+        for size in map(parse_size, args.sizes.split(",")):
+            for mode in MODES:
+                times = [run_once(path, size, mode) for _ in range(args.repeat)]
+                best = min(times)
+                results.append({"size": size, "mode": mode,
+                                "best_s": best, "times_s": times})
+                print("%6d MiB %-10s %9.3f ms" % (size >> 20, mode, best * 1e3))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"results": results}, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
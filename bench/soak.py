@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+# (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+"""
+Soak test: loop the whole binding API and check memory stays flat.
+
+Each iteration creates and drops Contexts, Labels, Partitions and
+PartTypes over sparse DOS and GPT image files. Every so often it also
+writes a label, verifies, aligns and cycles a ContextPool. RSS, open
+file descriptors, fdisk.live_objects() and optionally tracemalloc are
+sampled along the way. After a warm-up the run fails (exit 1) if RSS or
+traced memory keeps growing beyond the given limits, descriptors leak,
+or wrapper objects are left alive at the end.
+
+    python3 bench/soak.py [--iterations 1000000] [--tracemalloc] [--json out.json]
+"""
+
+import argparse
+import gc
+import json
+import os
+import sys
+import tempfile
+import time
+import tracemalloc
+
+import fdisk
+
+GPT_LINUX = "0FC63DAF-8483-4772-8E79-3D69D8477DE4"
+PAGE_SIZE = os.sysconf("SC_PAGE_SIZE")
+
+
+def rss():
+    with open("/proc/self/statm") as f:
+        return int(f.read().split()[1]) * PAGE_SIZE
+
+
+def nfds():
+    return len(os.listdir("/proc/self/fd"))
+
+
+def make_image(path, name, nparts):
+    with open(path, "wb") as f:
+        f.truncate(64 << 20)
+    cxt = fdisk.Context(path)
+    cxt.create_disklabel(name)
+    cxt.set_answers({"menu": "p"})
+    for _ in range(nparts):
+        pa = fdisk.Partition(partno_follow_default=True,
+                             start_follow_default=True)
+        pa.size = 8192
+        if name == "dos":
+            pa.type = cxt.label.get_parttype_from_code(0x83)
+        else:
+            pa.type = cxt.label.get_parttype_from_string(GPT_LINUX)
+        cxt.add_partition(pa, wipe="none")
+    cxt.write_disklabel()
+
+
+def light(images, fields):
+    """The read-only API, once per iteration."""
+    for path in images:
+        cxt = fdisk.Context(path, readonly=True)
+        label = cxt.label
+        repr(cxt)
+        for pa in cxt.partitions:
+            pa.as_tuple(("partno", "start", "end", "size", "name", "uuid"))
+            for field in fields:
+                cxt.partition_to_string(pa, field)
+            t = pa.type
+            t.name, t.string, t.code
+        if label.name == "dos":
+            label.get_parttype_from_code(0x83)
+        else:
+            label.get_parttype_from_string(GPT_LINUX)
+            # protective MBR, through the same device
+            cxt.nested("dos").partitions
+        # must stay usable after its Context is gone
+        orphan = fdisk.Label(cxt)
+        del cxt, label
+        orphan.name
+        fdisk.Partition(partno_follow_default=True).update(start=2048, size=4096)
+
+
+def heavy(images, scratch, pool):
+    """Writes, verification and device switching, every --heavy-every."""
+    make_image(scratch, "gpt", 4)
+    cxt = pool.acquire(images[0], readonly=True)
+    cxt.verify()
+    cxt.align([0, 1 << 20, 5 << 20], direction="up")
+    cxt.reassign(images[1], readonly=True)
+    cxt.reassign()
+    cxt.deassign()
+    pool.release(cxt)
+    fdisk.verify_many(images, workers=2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--iterations", type=int, default=1000000)
+    parser.add_argument("--duration", type=float, default=0,
+                        help="stop after this many seconds (default: no limit)")
+    parser.add_argument("--heavy-every", type=int, default=100)
+    parser.add_argument("--sample-every", type=int, default=1000)
+    parser.add_argument("--warmup", type=float, default=0.1,
+                        help="fraction of samples ignored (default 0.1)")
+    parser.add_argument("--max-rss-growth", type=int, default=8 << 20,
+                        help="bytes allowed after warm-up (default 8 MiB)")
+    parser.add_argument("--max-traced-growth", type=int, default=1 << 20,
+                        help="bytes allowed after warm-up (default 1 MiB)")
+    parser.add_argument("--tracemalloc", action="store_true",
+                        help="also track Python allocations (slower)")
+    parser.add_argument("--json", metavar="FILE", help="write samples as JSON")
+    args = parser.parse_args()
+
+    fields = [fdisk.FDISK_FIELD_START, fdisk.FDISK_FIELD_END,
+              fdisk.FDISK_FIELD_SIZE, fdisk.FDISK_FIELD_TYPE]
+    samples = []
+    if args.tracemalloc:
+        tracemalloc.start()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        images = [os.path.join(tmp, "dos.img"), os.path.join(tmp, "gpt.img")]
+        make_image(images[0], "dos", 4)
+        make_image(images[1], "gpt", 16)
+        scratch = os.path.join(tmp, "scratch.img")
+        pool = fdisk.ContextPool(2)
+
+        start = time.monotonic()
+        for i in range(1, args.iterations + 1):
+            light(images, fields)
+            if i % args.heavy_every == 0:
+                heavy(images, scratch, pool)
+            if i % args.sample_every == 0:
+                gc.collect()
+                s = {"iteration": i,
+                     "elapsed_s": round(time.monotonic() - start, 3),
+                     "rss": rss(),
+                     "fds": nfds(),
+                     "live": fdisk.live_objects()}
+                if args.tracemalloc:
+                    s["traced"] = tracemalloc.get_traced_memory()[0]
+                samples.append(s)
+                print("%9d %8.1fs rss %7.1f MiB fds %3d live %s%s" %
+                      (i, s["elapsed_s"], s["rss"] / 2**20, s["fds"],
+                       sum(s["live"].values()),
+                       "  traced %.1f KiB" % (s["traced"] / 1024)
+                       if args.tracemalloc else ""), flush=True)
+                if args.duration and s["elapsed_s"] >= args.duration:
+                    break
+        del pool
+        gc.collect()
+        leftover = fdisk.live_objects()
+
+    failures = []
+    if len(samples) >= 2:
+        base = samples[min(len(samples) - 2, int(len(samples) * args.warmup))]
+        last = samples[-1]
+        if last["rss"] - base["rss"] > args.max_rss_growth:
+            failures.append("RSS grew by %d bytes" % (last["rss"] - base["rss"]))
+        if last["fds"] > base["fds"]:
+            failures.append("%d file descriptors leaked" % (last["fds"] - base["fds"]))
+        if args.tracemalloc and last["traced"] - base["traced"] > args.max_traced_growth:
+            failures.append("traced memory grew by %d bytes" %
+                            (last["traced"] - base["traced"]))
+    if any(leftover.values()):
+        failures.append("objects still alive: %s" % leftover)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({"samples": samples, "leftover": leftover,
+                       "failures": failures}, f, indent=2)
+    for msg in failures:
+        print("FAIL:", msg)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
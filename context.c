@@ -16,37 +16,227 @@ static PyMemberDef Context_members[] = {
 	{ NULL }
 };
 
+/* Nested contexts reference their parent, which a subclass may point back to */
+static int Context_traverse(ContextObject *self, visitproc visit, void *arg)
+{
+	Py_VISIT(Py_TYPE(self));
+	Py_VISIT(self->parent);
+	return 0;
+}
+
+static int Context_clear(ContextObject *self)
+{
+	if (self->parent) {
+		__atomic_sub_fetch(&((ContextObject *) self->parent)->nchildren, 1,
+				   __ATOMIC_RELAXED);
+		Py_CLEAR(self->parent);
+	}
+	return 0;
+}
+
 static void Context_dealloc(ContextObject *self)
 {
-	if (!self->cxt) /* if init fails */
-		return;
+	PyTypeObject *tp = Py_TYPE(self);
 
-	fdisk_unref_context(self->cxt);
-	Py_TYPE(self)->tp_free((PyObject *) self);
+	PyObject_GC_UnTrack(self);
+	fdisk_free_iter(self->itr);
+	fdisk_unref_table(self->tb);
+	if (self->cxt) {
+		/* Labels may keep the libfdisk context alive */
+		fdisk_set_ask(self->cxt, NULL, NULL);
+		fdisk_unref_context(self->cxt);
+	}
+	free(self->wipes);
+	verify_sink_free(&self->probe);
+	answers_free(self->answers);
+	Context_clear(self);
+	pthread_mutex_destroy(&self->lock);
+	LIVE_DEC(self->st, LIVE_CONTEXT);
+	tp->tp_free((PyObject *) self);
+	Py_DECREF(tp);
 }
 
-static PyObject *Context_new(PyTypeObject *type,
-			 PyObject *args __attribute__((unused)),
-			 PyObject *kwds __attribute__((unused)))
+ContextObject *Context_alloc(PyTypeObject *type)
 {
 	ContextObject *self = (ContextObject*) type->tp_alloc(type, 0);
 
 	if (self) {
 		self->cxt = NULL;
 		self->tb = NULL;
+		self->itr = NULL;
+		self->wipes = NULL;
+		self->nwipes = 0;
+		self->probe.items = NULL;
+		self->probe.n = self->probe.alloc = 0;
+		self->probe.chain = self;
+		self->probe.forward = 1;
+		self->answers = NULL;
+		self->st = get_type_state(type);
+		self->parent = NULL;
+		self->nchildren = 0;
+		self->released = 0;
+		self->owner = 0;
+		pthread_mutex_init(&self->lock, NULL);
+		LIVE_INC(self->st, LIVE_CONTEXT);
+	}
+
+	return self;
+}
+
+static PyObject *Context_new(PyTypeObject *type,
+			 PyObject *args __attribute__((unused)),
+			 PyObject *kwds __attribute__((unused)))
+{
+	return (PyObject *) Context_alloc(type);
+}
+
+/*
+ * Define @name as a wrapper running @name##_unlocked with the context lock
+ * held, returning @err if the lock cannot be taken or the context was
+ * released to a ContextPool. Messages libfdisk reported meanwhile are
+ * passed to the logger once the lock is dropped.
+ */
+#define CONTEXT_LOCKED(rettype, err, name, params, args)	\
+	static rettype name params				\
+	{							\
+		rettype ret = err;				\
+								\
+		if (Context_lock(self) < 0)			\
+			return err;				\
+		if (self->released)				\
+			PyErr_SetString(PyExc_RuntimeError,	\
+					"Context released to its pool"); \
+		else						\
+			ret = name##_unlocked args;		\
+		Context_unlock(self);				\
+		log_flush_pending(self->st);			\
+		return ret;					\
 	}
 
-	return (PyObject *)self;
+static int Context_assign(ContextObject *self, const char *device, int readonly)
+{
+	uint64_t t0 = STATS_BEGIN();
+	int rc;
+
+	/* keep what probing the label complains about for verify() */
+	verify_sink_free(&self->probe);
+	fdisk_set_ask(self->cxt, verify_ask_cb, &self->probe);
+
+	USDT_PROBE(assign_device_entry, device, -1, 0);
+	rc = fdisk_assign_device(self->cxt, device, readonly);
+	USDT_PROBE(assign_device_return, device, -1, rc);
+	STATS_END(STAT_ASSIGN_DEVICE, t0, rc);
+
+	fdisk_set_ask(self->cxt, Context_ask_cb, self);
+	return rc;
+}
+
+static void Context_load_partitions(ContextObject *self)
+{
+	uint64_t t0 = STATS_BEGIN();
+	int rc;
+
+	/* fdisk_get_partitions() appends to an existing table */
+	if (self->tb)
+		fdisk_reset_table(self->tb);
+	rc = fdisk_get_partitions(self->cxt, &self->tb);
+	STATS_END(STAT_GET_PARTITIONS, t0, rc);
+}
+
+/*
+ * Drop the current device, if any, syncing it unless @nosync. The libfdisk
+ * context, partition table and iterator are kept for the next device.
+ * Switching devices passes @nosync set: the system wide sync() is only
+ * worth it when asked for with deassign() or ContextPool.release().
+ */
+int Context_release_device(ContextObject *self, int nosync)
+{
+	int rc = 0;
+
+	if (fdisk_get_devfd(self->cxt) >= 0)
+		rc = fdisk_deassign_device(self->cxt, nosync);
+	if (self->tb)
+		fdisk_reset_table(self->tb);
+	self->nwipes = 0;
+	verify_sink_free(&self->probe);
+	return rc;
+}
+
+/* libfdisk keeps the last label after deassigning the device */
+static int Context_has_label(ContextObject *self)
+{
+	return fdisk_has_label(self->cxt) && fdisk_get_devfd(self->cxt) >= 0;
+}
+
+/*
+ * A nested context reads and writes through its parent's file descriptor,
+ * so neither may switch or close the device while both exist. Returns -1
+ * with an exception set if that is the case.
+ */
+int Context_check_device(ContextObject *self)
+{
+	if (self->parent) {
+		PyErr_SetString(PyExc_RuntimeError,
+				"Nested context uses its parent's device");
+		return -1;
+	}
+	if (__atomic_load_n(&self->nchildren, __ATOMIC_RELAXED)) {
+		PyErr_SetString(PyExc_RuntimeError,
+				"Device in use by nested contexts");
+		return -1;
+	}
+	return 0;
+}
+
+/* Setup for Context() and ContextPool.acquire(), reusing self->cxt if set */
+int Context_setup(ContextObject *self, const char *device,
+		  int details, int readonly)
+{
+	int rc = 0;
+
+	USDT_PROBE(context_init_entry, device, -1, 0);
+
+	if (self->cxt) {
+		if (Context_check_device(self) < 0) {
+			rc = -EBUSY;
+			goto out;
+		}
+		if ((rc = Context_release_device(self, 1))) {
+			set_PyErr_from_rc(-rc);
+			goto out;
+		}
+	} else {
+		self->cxt = fdisk_new_context();
+		if (!self->cxt) {
+			PyErr_SetString(PyExc_MemoryError, "Couldn't allocate context");
+			rc = -ENOMEM;
+			goto out;
+		}
+		fdisk_set_ask(self->cxt, Context_ask_cb, self);
+	}
+
+	if (device && (rc = Context_assign(self, device, readonly))) {
+		set_PyErr_from_rc(-rc);
+		goto out;
+	}
+	if ((rc = fdisk_enable_details(self->cxt, details))) {
+		set_PyErr_from_rc(-rc);
+		goto out;
+	}
+	Context_load_partitions(self);
+out:
+	USDT_PROBE(context_init_return, device, -1, rc);
+	return rc ? -1 : 0;
 }
 
 #define Context_HELP "Context(device=None, details=True, readonly=False)"
-static int Context_init(ContextObject *self, PyObject *args, PyObject *kwds)
+static int Context_init_unlocked(ContextObject *self, PyObject *args, PyObject *kwds)
 {
 	static char *kwlist[] = {
 		"device", "details", "readonly",
 		NULL
 	};
-	int details = 1, readonly = 0, rc = 0;
+	int details = 1, readonly = 0;
 	char *device = NULL;
 
 	if (!PyArg_ParseTupleAndKeywords(args,
@@ -56,92 +246,224 @@ static int Context_init(ContextObject *self, PyObject *args, PyObject *kwds)
 		return -1;
 	}
 
-	if (self->cxt)
-		fdisk_unref_context(self->cxt);
+	return Context_setup(self, device, details, readonly);
+}
+CONTEXT_LOCKED(int, -1, Context_init,
+	       (ContextObject *self, PyObject *args, PyObject *kwds),
+	       (self, args, kwds))
 
-	self->cxt = fdisk_new_context();
-	if (!self->cxt) {
-		PyErr_SetString(PyExc_MemoryError, "Couldn't allocate context");
-		return -1;
-	}
+/*
+ * Fast path for Context(...): skips the argument tuple/dict built by the
+ * generic tp_new + tp_init sequence. Subclasses go through the latter.
+ */
+static PyObject *Context_vectorcall(PyObject *type, PyObject *const *args,
+				    size_t nargsf, PyObject *kwnames)
+{
+	static const char * const kwlist[] = {
+		"device", "details", "readonly",
+		NULL
+	};
+	PyObject *argv[3] = { NULL, NULL, NULL };
+	int details = 1, readonly = 0;
+	const char *device = NULL;
+	ContextObject *self;
 
-	if (device && (rc = fdisk_assign_device(self->cxt, device, readonly))) {
-		set_PyErr_from_rc(-rc);
-		return -1;
+	if ((PyTypeObject *) type != get_type_state((PyTypeObject *) type)->ContextType)
+		return vectorcall_type_call(type, args, nargsf, kwnames);
+
+	if (unpack_fastcall_args(args, PyVectorcall_NARGS(nargsf), kwnames,
+				 kwlist, 3, 0, argv) < 0)
+		return NULL;
+
+	if (argv[0] && !(device = PyUnicode_AsUTF8(argv[0]))) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
 	}
-	if (details && (rc = fdisk_enable_details(self->cxt, details))) {
-		set_PyErr_from_rc(-rc);
-		return -1;
+	if (argv[1] && (details = PyObject_IsTrue(argv[1])) < 0)
+		return NULL;
+	if (argv[2] && (readonly = PyObject_IsTrue(argv[2])) < 0)
+		return NULL;
+
+	self = Context_alloc((PyTypeObject *) type);
+	if (!self)
+		return NULL;
+
+	if (Context_setup(self, device, details, readonly) < 0) {
+		Py_DECREF(self);
+		return NULL;
 	}
-	fdisk_get_partitions(self->cxt, &self->tb);
 
-	return 0;
+	return (PyObject *) self;
 }
 
 #define Context_assign_device_HELP "assign_device(device, readonly=False)\n\n" \
 	"Open the device, discovery topology, geometry, detect disklabel " \
 	"and switch the current label driver to reflect the probing result. "
-static PyObject *Context_assign_device(ContextObject *self, PyObject *args, PyObject *kwds)
+static PyObject *Context_assign_device_unlocked(ContextObject *self, PyObject *const *args,
+				       Py_ssize_t nargs, PyObject *kwnames)
 {
-	static char *kwlist[] = { "", "readonly", NULL };
+	static const char * const kwlist[] = { "", "readonly", NULL };
+	PyObject *argv[2] = { NULL, NULL };
 	int rc, readonly = 0;
-	char *device;
+	const char *device;
 
 	if (!self->cxt) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
 
-	if (!PyArg_ParseTupleAndKeywords(args,
-					 kwds, "s|$p", kwlist,
-					 &device, &readonly)) {
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 1, 1, argv) < 0)
+		return NULL;
+	if (!(device = PyUnicode_AsUTF8(argv[0]))) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
+	if (argv[1] && (readonly = PyObject_IsTrue(argv[1])) < 0)
+		return NULL;
+	if (Context_check_device(self) < 0)
+		return NULL;
 
-	if ((rc = fdisk_assign_device(self->cxt, device, readonly)) < 0) {
+	if ((rc = Context_release_device(self, 1)) < 0 ||
+	    (rc = Context_assign(self, device, readonly)) < 0) {
 		set_PyErr_from_rc(-rc);
 		return NULL;
 	}
-	fdisk_get_partitions(self->cxt, &self->tb);
+	Context_load_partitions(self);
 
 	Py_INCREF(Py_None);
 	return Py_None;
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_assign_device,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
+
+#define Context_deassign_HELP "deassign(nosync=False)\n\n" \
+	"Close the device. A writable device is fsync()ed first and, unless " \
+	"nosync, the whole system is sync()ed too. Unwritten changes are lost. " \
+	"The context can be given another device with reassign() or " \
+	"assign_device(), which never sync()."
+static PyObject *Context_deassign_unlocked(ContextObject *self, PyObject *const *args,
+					   Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "nosync", NULL };
+	PyObject *argv[1] = { NULL };
+	int rc, nosync = 0;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 1, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && (nosync = PyObject_IsTrue(argv[0])) < 0)
+		return NULL;
+	if (Context_check_device(self) < 0)
+		return NULL;
+
+	if ((rc = Context_release_device(self, nosync)) < 0) {
+		set_PyErr_from_rc(-rc);
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_deassign,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
+
+#define Context_reassign_HELP "reassign(device=None, readonly=False)\n\n" \
+	"Switch the context to another device, reusing the libfdisk context. " \
+	"Without device, reopen the current one and re-read its label, " \
+	"dropping unwritten changes."
+static PyObject *Context_reassign_unlocked(ContextObject *self, PyObject *const *args,
+					   Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "device", "readonly", NULL };
+	PyObject *argv[2] = { NULL, NULL };
+	const char *device = NULL;
+	int rc, readonly = 0;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 2, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && argv[0] != Py_None && !(device = PyUnicode_AsUTF8(argv[0]))) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	if (argv[1] && (readonly = PyObject_IsTrue(argv[1])) < 0)
+		return NULL;
+	if (Context_check_device(self) < 0)
+		return NULL;
+
+	if (device) {
+		if ((rc = Context_release_device(self, 1)) == 0)
+			rc = Context_assign(self, device, readonly);
+	} else if (fdisk_get_devfd(self->cxt) < 0) {
+		PyErr_SetString(PyExc_RuntimeError, "No device assigned");
+		return NULL;
+	} else {
+		self->nwipes = 0;
+		verify_sink_free(&self->probe);
+		fdisk_set_ask(self->cxt, verify_ask_cb, &self->probe);
+		rc = fdisk_reassign_device(self->cxt);
+		fdisk_set_ask(self->cxt, Context_ask_cb, self);
+	}
+	if (rc < 0) {
+		set_PyErr_from_rc(-rc);
+		return NULL;
+	}
+	Context_load_partitions(self);
+
+	Py_RETURN_NONE;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_reassign,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
 
 #define Context_partition_to_string_HELP "partition_to_string(pa, field)\n\n" \
-	"Retrieve partition field using fdisk_partition_to_string." \
-	"Field constants are available as FDISK_LABEL_*"
-static PyObject *Context_partition_to_string(ContextObject *self, PyObject *args, PyObject *kwds)
+	"Retrieve partition field using fdisk_partition_to_string. " \
+	"Field constants are available as FDISK_FIELD_*"
+static PyObject *Context_partition_to_string_unlocked(ContextObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-	struct fdisk_partition *pa;
-	enum fdisk_fieldtype field;
-	PartitionObject *part;
+	PartitionObject *partobj;
+	char *data = NULL;
 	PyObject *ret;
-	char *data;
+	long field;
+	int rc;
 
-	if (!PyArg_ParseTuple(args, "O!i", &PartitionType, &part, &field)) {
+	if (nargs != 2 || !PyObject_TypeCheck(args[0], self->st->PartitionType) || !self->cxt) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
+	partobj = (PartitionObject *) args[0];
+	field = PyLong_AsLong(args[1]);
+	if (field == -1 && PyErr_Occurred()) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	if (field <= FDISK_FIELD_NONE || field >= FDISK_NFIELDS) {
+		PyErr_Format(PyExc_ValueError, "Invalid partition field %ld", field);
+		return NULL;
+	}
 
-	pa = part->pa;
-
-	fdisk_partition_to_string(pa, self->cxt, field, &data);
+	Py_BEGIN_CRITICAL_SECTION(partobj);
+	rc = partobj->pa ? fdisk_partition_to_string(partobj->pa, self->cxt, field, &data) : -EINVAL;
+	Py_END_CRITICAL_SECTION();
+	if (rc < 0)
+		return set_PyErr_from_rc(-rc);
 	ret = Py_BuildValue("s", data);
 	free(data);
 
 	return ret;
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_partition_to_string,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs),
+	       (self, args, nargs))
 
 #define Context_create_disklabel_HELP "create_disklabel(label)\n\n" \
 	"Creates a new disk label of type name . If name is NULL, " \
 	"then it will create a default system label type, either SUN or DOS."
-static PyObject *Context_create_disklabel(ContextObject *self, PyObject *args, PyObject *kwds)
+static PyObject *Context_create_disklabel_unlocked(ContextObject *self, PyObject *const *args, Py_ssize_t nargs)
 {
-	char *label_name = NULL;
+	const char *label_name = NULL;
 
-	if (!PyArg_ParseTuple(args, "|s", &label_name)) {
+	if (nargs > 1 ||
+	    (nargs == 1 && args[0] != Py_None && !(label_name = PyUnicode_AsUTF8(args[0])))) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
@@ -150,127 +472,659 @@ static PyObject *Context_create_disklabel(ContextObject *self, PyObject *args, P
 		PyErr_Format(PyExc_RuntimeError, "Error creating label %s", label_name);
 		return NULL;
 	}
+	self->nwipes = 0;
+	verify_sink_free(&self->probe);
 
 	Py_RETURN_NONE;
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_create_disklabel,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs),
+	       (self, args, nargs))
+
+/* Bytes wiped between progress reports */
+#define WIPE_CHUNK	(1ULL << 30)
+
+/*
+ * Discard or zero the partitions queued with wipe="discard"/"zeroout".
+ * Runs before the label is written, so the signature wipe libfdisk does
+ * then for "discard" comes last and stale data a non-deterministic TRIM
+ * may return cannot bring old signatures back. The I/O runs without the
+ * GIL; @progress, if not NULL, is called as progress(partno, done, total)
+ * after every WIPE_CHUNK bytes.
+ */
+static int Context_run_wipes(ContextObject *self, struct pending_wipe *wipes,
+			     size_t nwipes, PyObject *progress)
+{
+	unsigned long ssz = fdisk_get_sector_size(self->cxt);
+	int fd = fdisk_get_devfd(self->cxt);
+	int regfile = fdisk_is_regfile(self->cxt);
+	size_t i;
+
+	for (i = 0; i < nwipes; i++) {
+		struct fdisk_partition *pa = NULL;
+		uint64_t offset, len, done, n, t0;
+		int rc = 0;
+
+		if (wipes[i].mode != WIPE_DISCARD && wipes[i].mode != WIPE_ZEROOUT)
+			continue;
+
+		if ((rc = fdisk_get_partition(self->cxt, wipes[i].partno, &pa)) < 0) {
+			PyErr_Format(PyExc_RuntimeError, "Error wiping partition %zu: %s",
+				     wipes[i].partno, strerror(-rc));
+			return -1;
+		}
+		offset = fdisk_partition_get_start(pa) * ssz;
+		len = fdisk_partition_get_size(pa) * ssz;
+		fdisk_unref_partition(pa);
 
-#define Context_write_disklabel_HELP "write_disklabel()\n\n" \
+		t0 = STATS_BEGIN();
+		for (done = 0; done < len && rc == 0; done += n) {
+			n = len - done < WIPE_CHUNK ? len - done : WIPE_CHUNK;
+
+			Py_BEGIN_ALLOW_THREADS
+			rc = wipe_range(fd, regfile, wipes[i].mode, offset + done, n);
+			Py_END_ALLOW_THREADS
+
+			if (rc == 0 && progress) {
+				PyObject *res = PyObject_CallFunction(progress, "nKK",
+						(Py_ssize_t) wipes[i].partno, done + n, len);
+				if (!res)
+					return -1;
+				Py_DECREF(res);
+			}
+		}
+		STATS_END(STAT_WIPE, t0, rc);
+		if (rc < 0) {
+			PyErr_Format(PyExc_RuntimeError, "Error wiping partition %zu: %s",
+				     wipes[i].partno, strerror(-rc));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#define Context_write_disklabel_HELP "write_disklabel(wipe=None, progress=None)\n\n" \
 	"This function wipes the device (if enabled by fdisk_enable_wipe()) " \
-	"and then it writes in-memory changes to disk. Be careful!"
-static PyObject *Context_write_disklabel(ContextObject *self, PyObject *args, PyObject *kwds)
+	"and then it writes in-memory changes to disk. Be careful!\n\n" \
+	"Partitions added since the last write are wiped as requested by " \
+	"add_partition(); wipe overrides the mode for all of them. 'discard' " \
+	"and 'zeroout' run first, with the GIL released, and call " \
+	"progress(partno, done_bytes, total_bytes) every GiB. If one of them " \
+	"fails or progress raises, the label is not written and all the wipes " \
+	"stay pending for the next write_disklabel()."
+static PyObject *Context_write_disklabel_unlocked(ContextObject *self, PyObject *const *args,
+						  Py_ssize_t nargs, PyObject *kwnames)
 {
-	int ret;
+	static const char * const kwlist[] = { "wipe", "progress", NULL };
+	PyObject *argv[2] = { NULL, NULL }, *progress = NULL;
+	size_t i;
+	int ret, mode = -1;
+	uint64_t t0;
 
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 0, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && argv[0] != Py_None && wipe_mode_from_object(argv[0], &mode) < 0)
+		return NULL;
+	if (argv[1] && argv[1] != Py_None) {
+		if (!PyCallable_Check(argv[1])) {
+			PyErr_SetString(PyExc_TypeError, "progress must be callable");
+			return NULL;
+		}
+		progress = argv[1];
+	}
+
+	for (i = 0; mode >= 0 && i < self->nwipes; i++) {
+		self->wipes[i].mode = mode;
+		fdisk_wipe_partition(self->cxt, self->wipes[i].partno,
+				     mode == WIPE_SIGNATURES || mode == WIPE_DISCARD);
+	}
+
+	if (Context_run_wipes(self, self->wipes, self->nwipes, progress) < 0)
+		return NULL;
+
+	t0 = STATS_BEGIN();
+	USDT_PROBE(write_disklabel_entry, fdisk_get_devname(self->cxt), -1, 0);
 	ret = fdisk_write_disklabel(self->cxt);
+	USDT_PROBE(write_disklabel_return, fdisk_get_devname(self->cxt), -1, ret);
+	STATS_END(STAT_WRITE_DISKLABEL, t0, ret);
 	if (ret < 0) {
 		PyErr_Format(PyExc_RuntimeError, "Error writing label to disk: %s", strerror(-ret));
 		return NULL;
 	}
 
+	/* the label is on disk now, never wipe these partitions twice */
+	verify_sink_free(&self->probe);
+	self->nwipes = 0;
+
 	Py_RETURN_NONE;
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_write_disklabel,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
 
-#define Context_add_partition_HELP "add_partition(fdisk.Partition)\n\n" \
-	"Adds partition to context. Returns partno of the new partition."
-static PyObject *Context_add_partition(ContextObject *self, PyObject *args, PyObject *kwds)
+#define Context_add_partition_HELP "add_partition(fdisk.Partition, wipe='signatures')\n\n" \
+	"Adds partition to context. Returns partno of the new partition.\n\n" \
+	"wipe selects what write_disklabel() does to the partition area: " \
+	"'signatures' removes filesystem/RAID signatures, 'discard' also " \
+	"discards the whole partition (BLKDISCARD), 'zeroout' zeroes it " \
+	"(BLKZEROOUT) and 'none' leaves it alone. On image files 'discard' and " \
+	"'zeroout' punch holes / zero ranges instead."
+static PyObject *Context_add_partition_unlocked(ContextObject *self, PyObject *const *args,
+						Py_ssize_t nargs, PyObject *kwnames)
 {
+	static const char * const kwlist[] = { "", "wipe", NULL };
+	PyObject *argv[2] = { NULL, NULL };
+	struct pending_wipe *wipes;
+	int rc, mode = WIPE_SIGNATURES;
 	PartitionObject *partobj;
+	uint64_t t0;
 	size_t partno;
-	int rc;
 
-	if (!PyArg_ParseTuple(args, "O!", &PartitionType, &partobj)) {
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 1, 1, argv) < 0)
+		return NULL;
+	if (!PyObject_TypeCheck(argv[0], self->st->PartitionType)) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
+	partobj = (PartitionObject *) argv[0];
 
+	if (argv[1] && wipe_mode_from_object(argv[1], &mode) < 0)
+		return NULL;
+
+	wipes = realloc(self->wipes, (self->nwipes + 1) * sizeof(*wipes));
+	if (!wipes)
+		return PyErr_NoMemory();
+	self->wipes = wipes;
+
+	/* partobj may be shared with other threads and contexts */
+	Py_BEGIN_CRITICAL_SECTION(partobj);
 	if (!partobj->pa) {
+		rc = 1;
+	} else {
+		t0 = STATS_BEGIN();
+		USDT_PROBE(add_partition_entry, fdisk_get_devname(self->cxt),
+			   fdisk_partition_has_partno(partobj->pa) ?
+			   (long) fdisk_partition_get_partno(partobj->pa) : -1L, 0);
+		rc = fdisk_add_partition(self->cxt, partobj->pa, &partno);
+		USDT_PROBE(add_partition_return, fdisk_get_devname(self->cxt),
+			   rc < 0 ? -1L : (long) partno, rc);
+		STATS_END(STAT_ADD_PARTITION, t0, rc);
+	}
+	Py_END_CRITICAL_SECTION();
+	if (rc > 0) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
-
-	rc = fdisk_add_partition(self->cxt, partobj->pa, &partno);
 	if (rc < 0) {
 		PyErr_Format(PyExc_RuntimeError, "Error adding partition to context: %s", strerror(-rc));
 		return NULL;
 	}
-	rc = fdisk_wipe_partition(self->cxt, partno, 1);
+	/* only flags the partition, signatures go with write_disklabel */
+	rc = fdisk_wipe_partition(self->cxt, partno,
+				  mode == WIPE_SIGNATURES || mode == WIPE_DISCARD);
 	if (rc < 0) {
 		PyErr_Format(PyExc_RuntimeError, "Error setting wipe for new partition: %s", strerror(-rc));
 		return NULL;
 	}
+	wipes[self->nwipes].partno = partno;
+	wipes[self->nwipes].mode = mode;
+	self->nwipes++;
 
 	return Py_BuildValue("n", partno);
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_add_partition,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
+
+#define Context_verify_HELP "verify()\n\n" \
+	"Checks the disklabel and returns the problems found, without printing " \
+	"them, as a list of dicts with keys 'kind' ('overlap', 'alignment', " \
+	"'checksum', 'range' or 'other'), 'partno' (None if not about a single " \
+	"partition) and 'message'. Includes what libfdisk reported when the " \
+	"label was read, e.g. a corrupt primary GPT. An empty list means the " \
+	"label is fine."
+static PyObject *Context_verify_unlocked(ContextObject *self, PyObject *Py_UNUSED(ignored))
+{
+	struct verify_sink sink = { NULL, 0, 0, self, 0 };
+	PyObject *ret, *problems;
+	int rc;
+
+	if (!self->cxt) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	rc = verify_context(self->cxt, &sink);
+	fdisk_set_ask(self->cxt, Context_ask_cb, self);
+	if (rc < 0) {
+		verify_sink_free(&sink);
+		PyErr_Format(PyExc_RuntimeError, "Error verifying disklabel: %s", strerror(-rc));
+		return NULL;
+	}
+
+	ret = verify_sink_to_list(&self->probe);
+	problems = verify_sink_to_list(&sink);
+	verify_sink_free(&sink);
+	if (!ret || !problems ||
+	    PyList_SetSlice(ret, PY_SSIZE_T_MAX, PY_SSIZE_T_MAX, problems) < 0) {
+		Py_XDECREF(ret);
+		Py_XDECREF(problems);
+		return NULL;
+	}
+	Py_DECREF(problems);
+	return ret;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_verify,
+	       (ContextObject *self, PyObject *ignored),
+	       (self, ignored))
+
+#define Context_set_answers_HELP "set_answers(answers)\n\n" \
+	"Answer libfdisk's questions (first/last sector, partition number, " \
+	"partition type menu, yes/no...) without prompting or calling back " \
+	"into Python. answers is a dict with optional keys:\n\n" \
+	"  'number': int, 'default', 'low' or 'high' (default 'default'),\n" \
+	"            used for numbers and sector offsets\n" \
+	"  'yesno':  bool, 'yes' or 'no' (default False)\n" \
+	"  'menu':   menu key, e.g. 'p', or 'default' (default 'default')\n" \
+	"  'string': str (string questions fail without it)\n" \
+	"  'queries': dict mapping a substring of the question, e.g. " \
+	"'Last sector', to the answer to use instead: a (kind, value) tuple " \
+	"with kind one of the keys above, a bool (yesno), an int, 'low' or " \
+	"'high' (number), or 'default' (number or menu). It only applies to " \
+	"questions of that kind.\n\n" \
+	"Invalid answers raise ValueError here. A number out of the allowed " \
+	"range fails the operation. With " \
+	"answers=None, the default, questions fail as if there was no dialog " \
+	"handler."
+static PyObject *Context_set_answers_unlocked(ContextObject *self, PyObject *const *args,
+					      Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "answers", NULL };
+	PyObject *argv[1] = { NULL };
+	struct ask_answers *answers = NULL;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 1, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && argv[0] != Py_None && !(answers = answers_from_object(argv[0])))
+		return NULL;
+
+	answers_free(self->answers);
+	self->answers = answers;
+
+	Py_RETURN_NONE;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_set_answers,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
+
+/* Read @obj, a buffer of integers or a sequence of ints, as uint64_t */
+static uint64_t *Context_align_values(PyObject *obj, Py_ssize_t *n)
+{
+	uint64_t *values = NULL;
+	Py_buffer view;
+	PyObject *seq;
+	Py_ssize_t i;
+
+	if (PyObject_CheckBuffer(obj)) {
+		const char *fmt;
+		int sign;
+
+		if (PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS) < 0)
+			return NULL;
+		fmt = view.format ? view.format : "B";
+		if (*fmt == '@')
+			fmt++;
+		if (!fmt[0] || fmt[1] || !strchr("bBhHiIlLqQnN", fmt[0])) {
+			PyErr_Format(PyExc_TypeError, "unsupported buffer format '%s'", view.format);
+			goto out;
+		}
+		sign = Py_ISLOWER(fmt[0]);
+		*n = view.len / view.itemsize;
+		values = PyMem_Malloc((*n ? *n : 1) * sizeof(*values));
+		if (!values) {
+			PyErr_NoMemory();
+			goto out;
+		}
+		for (i = 0; i < *n; i++) {
+			const char *p = (const char *) view.buf + i * view.itemsize;
+			int64_t v = 0;
+
+			switch (view.itemsize) {
+			case 1: v = sign ? (int64_t) *(int8_t *) p : (int64_t) *(uint8_t *) p; break;
+			case 2: v = sign ? (int64_t) *(int16_t *) p : (int64_t) *(uint16_t *) p; break;
+			case 4: v = sign ? (int64_t) *(int32_t *) p : (int64_t) *(uint32_t *) p; break;
+			case 8: v = *(int64_t *) p; break;
+			}
+			if (sign && v < 0) {
+				PyErr_SetString(PyExc_ValueError, "values must not be negative");
+				PyMem_Free(values);
+				values = NULL;
+				goto out;
+			}
+			values[i] = (uint64_t) v;
+		}
+out:
+		PyBuffer_Release(&view);
+		return values;
+	}
+
+	seq = PySequence_Fast(obj, "values must be a buffer or a sequence of ints");
+	if (!seq)
+		return NULL;
+	*n = PySequence_Fast_GET_SIZE(seq);
+	values = PyMem_Malloc((*n ? *n : 1) * sizeof(*values));
+	if (!values) {
+		Py_DECREF(seq);
+		return (uint64_t *) PyErr_NoMemory();
+	}
+	for (i = 0; i < *n; i++) {
+		values[i] = PyLong_AsUnsignedLongLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (values[i] == (uint64_t) -1 && PyErr_Occurred()) {
+			PyMem_Free(values);
+			Py_DECREF(seq);
+			return NULL;
+		}
+	}
+	Py_DECREF(seq);
+	return values;
+}
+
+/* Round @v to a multiple of @grain sectors, for sizes */
+static uint64_t Context_align_size(uint64_t v, uint64_t grain, int direction)
+{
+	uint64_t rem = v % grain;
+
+	if (direction == FDISK_ALIGN_UP)
+		return rem ? v - rem + grain : v;
+	if (direction == FDISK_ALIGN_NEAREST && rem * 2 >= grain)
+		return v - rem + grain;
+	return v - rem;
+}
+
+#define Context_align_HELP "align(values, unit='bytes', direction='nearest', kind='offset')\n\n" \
+	"Align many values at once to the device topology, as libfdisk does " \
+	"for new partitions. values is a buffer of integers (e.g. " \
+	"array('Q'), numpy) or a sequence of ints, in unit 'bytes' or " \
+	"'sectors'; direction is 'up', 'down' or 'nearest'.\n\n" \
+	"kind 'offset' aligns partition start LBAs to the grain size and " \
+	"alignment offset; like libfdisk, offsets before the first usable LBA " \
+	"become the first usable LBA whatever the direction. kind 'size' " \
+	"rounds sector counts to a multiple of the grain size, without that " \
+	"limit or the alignment offset. Returns an array('Q') of sectors; " \
+	"OverflowError is raised for an offset past the last LBA or a size " \
+	"larger than the device."
+static PyObject *Context_align_unlocked(ContextObject *self, PyObject *const *args,
+					Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "values", "unit", "direction", "kind", NULL };
+	static const char * const directions[] = { "up", "down", "nearest", NULL };
+	static const int direction_flags[] = { FDISK_ALIGN_UP, FDISK_ALIGN_DOWN, FDISK_ALIGN_NEAREST };
+	PyObject *argv[4] = { NULL, NULL, NULL, NULL }, *bytes = NULL, *ret = NULL;
+	const char *unit = "bytes", *direction = "nearest", *kind = "offset";
+	uint64_t *values, *lba, grain, limit;
+	int dir, bytes_unit, size_kind;
+	unsigned long ssz;
+	Py_ssize_t i, n;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 4, 1, argv) < 0)
+		return NULL;
+	if (argv[1] && !(unit = PyUnicode_AsUTF8(argv[1])))
+		return NULL;
+	if (argv[2] && !(direction = PyUnicode_AsUTF8(argv[2])))
+		return NULL;
+	if (argv[3] && !(kind = PyUnicode_AsUTF8(argv[3])))
+		return NULL;
+
+	if (!self->cxt) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	/* no topology to align to, libfdisk would divide by zero */
+	ssz = fdisk_get_sector_size(self->cxt);
+	if (fdisk_get_devfd(self->cxt) < 0 || ssz == 0) {
+		PyErr_SetString(PyExc_RuntimeError, "No device assigned");
+		return NULL;
+	}
+	grain = fdisk_get_grain_size(self->cxt) / ssz;
+	if (grain == 0)
+		grain = 1;
+
+	if (!strcmp(unit, "bytes")) {
+		bytes_unit = 1;
+	} else if (!strcmp(unit, "sectors")) {
+		bytes_unit = 0;
+	} else {
+		PyErr_SetString(PyExc_ValueError, "unit must be 'bytes' or 'sectors'");
+		return NULL;
+	}
+	for (dir = 0; directions[dir]; dir++) {
+		if (!strcmp(direction, directions[dir]))
+			break;
+	}
+	if (!directions[dir]) {
+		PyErr_SetString(PyExc_ValueError, "direction must be 'up', 'down' or 'nearest'");
+		return NULL;
+	}
+	if (!strcmp(kind, "offset")) {
+		size_kind = 0;
+	} else if (!strcmp(kind, "size")) {
+		size_kind = 1;
+	} else {
+		PyErr_SetString(PyExc_ValueError, "kind must be 'offset' or 'size'");
+		return NULL;
+	}
+	limit = size_kind ? fdisk_get_nsectors(self->cxt) : fdisk_get_last_lba(self->cxt);
+
+	values = Context_align_values(argv[0], &n);
+	if (!values)
+		return NULL;
+	bytes = PyBytes_FromStringAndSize(NULL, n * sizeof(*lba));
+	if (!bytes)
+		goto out;
+	lba = (uint64_t *) PyBytes_AS_STRING(bytes);
+
+	Py_BEGIN_ALLOW_THREADS
+	for (i = 0; i < n; i++) {
+		uint64_t v = values[i];
+
+		/* round partial sectors the same way as the alignment */
+		if (bytes_unit) {
+			if (direction_flags[dir] == FDISK_ALIGN_UP)
+				v = v / ssz + (v % ssz != 0);
+			else if (direction_flags[dir] == FDISK_ALIGN_NEAREST)
+				v = v / ssz + (v % ssz >= (ssz + 1) / 2);
+			else
+				v = v / ssz;
+		}
+		/* checked first too, so that rounding up cannot wrap around */
+		if (v > limit)
+			break;
+		if (size_kind)
+			lba[i] = Context_align_size(v, grain, direction_flags[dir]);
+		else
+			lba[i] = fdisk_align_lba(self->cxt, v, direction_flags[dir]);
+		if (lba[i] > limit)
+			break;
+	}
+	Py_END_ALLOW_THREADS
+
+	if (i < n) {
+		PyErr_Format(PyExc_OverflowError, "value %llu at index %zd is past the %s",
+			     (unsigned long long) values[i], i,
+			     size_kind ? "device size" : "last LBA");
+		goto out;
+	}
+	ret = PyObject_CallFunction(self->st->array_type, "sO", "Q", bytes);
+out:
+	Py_XDECREF(bytes);
+	PyMem_Free(values);
+	return ret;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_align,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
+
+#define Context_nested_HELP "nested(label)\n\n" \
+	"Returns a Context for a label nested in this one, 'dos' or 'mbr' " \
+	"(e.g. the protective or hybrid MBR of a GPT disk) or 'bsd' (inside a " \
+	"DOS partition, only for a context with a DOS label). It uses this " \
+	"context's open device and geometry, without reopening or probing the " \
+	"disk again, and has no label if the nested one is not found. Changes are written with its own write_disklabel(). " \
+	"Neither context can switch or close the device while the nested one " \
+	"exists."
+static PyObject *Context_nested_unlocked(ContextObject *self, PyObject *const *args,
+					 Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "label", NULL };
+	PyObject *argv[1] = { NULL };
+	ContextObject *child;
+	const char *name;
+
+	if (!self->cxt) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 1, 1, argv) < 0)
+		return NULL;
+	if (!(name = PyUnicode_AsUTF8(argv[0]))) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	/* the only labels libfdisk nests, it ignores any other name */
+	if (strcasecmp(name, "dos") && strcasecmp(name, "mbr") && strcasecmp(name, "bsd")) {
+		PyErr_SetString(PyExc_ValueError, "label must be 'dos', 'mbr' or 'bsd'");
+		return NULL;
+	}
+	/* libfdisk asserts the BSD label is inside a DOS partition */
+	if (!strcasecmp(name, "bsd") && !fdisk_is_label(self->cxt, DOS)) {
+		PyErr_SetString(PyExc_ValueError, "'bsd' needs a context with a DOS label");
+		return NULL;
+	}
+
+	child = Context_alloc(self->st->ContextType);
+	if (!child)
+		return NULL;
+
+	/* the nested label is probed with the parent's dialog callback */
+	fdisk_set_ask(self->cxt, verify_ask_cb, &child->probe);
+	child->cxt = fdisk_new_nested_context(self->cxt, name);
+	fdisk_set_ask(self->cxt, Context_ask_cb, self);
+	if (!child->cxt) {
+		Py_DECREF(child);
+		PyErr_SetString(PyExc_MemoryError, "Couldn't allocate nested context");
+		return NULL;
+	}
+	fdisk_set_ask(child->cxt, Context_ask_cb, child);
+
+	Py_INCREF(self);
+	child->parent = (PyObject *) self;
+	__atomic_add_fetch(&self->nchildren, 1, __ATOMIC_RELAXED);
+	Context_load_partitions(child);
+
+	return (PyObject *) child;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_nested,
+	       (ContextObject *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames),
+	       (self, args, nargs, kwnames))
 
 static PyMethodDef Context_methods[] = {
-	{"assign_device",	(PyCFunction)Context_assign_device, METH_VARARGS | METH_KEYWORDS, Context_assign_device_HELP},
-	{"partition_to_string",	(PyCFunction)Context_partition_to_string, METH_VARARGS, Context_partition_to_string_HELP},
-	{"create_disklabel",	(PyCFunction)Context_create_disklabel, METH_VARARGS, Context_create_disklabel_HELP},
-	{"write_disklabel",	(PyCFunction)Context_write_disklabel, METH_NOARGS, Context_write_disklabel_HELP},
-	{"add_partition",	(PyCFunction)Context_add_partition, METH_VARARGS, Context_add_partition_HELP},
+	{"assign_device",	(PyCFunction)(void(*)(void))Context_assign_device, METH_FASTCALL | METH_KEYWORDS, Context_assign_device_HELP},
+	{"deassign",		(PyCFunction)(void(*)(void))Context_deassign, METH_FASTCALL | METH_KEYWORDS, Context_deassign_HELP},
+	{"reassign",		(PyCFunction)(void(*)(void))Context_reassign, METH_FASTCALL | METH_KEYWORDS, Context_reassign_HELP},
+	{"partition_to_string",	(PyCFunction)(void(*)(void))Context_partition_to_string, METH_FASTCALL, Context_partition_to_string_HELP},
+	{"create_disklabel",	(PyCFunction)(void(*)(void))Context_create_disklabel, METH_FASTCALL, Context_create_disklabel_HELP},
+	{"write_disklabel",	(PyCFunction)(void(*)(void))Context_write_disklabel, METH_FASTCALL | METH_KEYWORDS, Context_write_disklabel_HELP},
+	{"add_partition",	(PyCFunction)(void(*)(void))Context_add_partition, METH_FASTCALL | METH_KEYWORDS, Context_add_partition_HELP},
+	{"verify",		(PyCFunction)Context_verify, METH_NOARGS, Context_verify_HELP},
+	{"set_answers",		(PyCFunction)(void(*)(void))Context_set_answers, METH_FASTCALL | METH_KEYWORDS, Context_set_answers_HELP},
+	{"align",		(PyCFunction)(void(*)(void))Context_align, METH_FASTCALL | METH_KEYWORDS, Context_align_HELP},
+	{"nested",		(PyCFunction)(void(*)(void))Context_nested, METH_FASTCALL | METH_KEYWORDS, Context_nested_HELP},
 	{NULL}
 };
 
-static PyObject *Context_get_nsectors(ContextObject *self)
+static PyObject *Context_get_nsectors_unlocked(ContextObject *self)
 {
 	return PyLong_FromUnsignedLong(fdisk_get_nsectors(self->cxt));
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_nsectors,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static PyObject *Context_get_sector_size(ContextObject *self)
+static PyObject *Context_get_sector_size_unlocked(ContextObject *self)
 {
 	return PyLong_FromUnsignedLong(fdisk_get_sector_size(self->cxt));
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_sector_size,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static PyObject *Context_get_devname(ContextObject *self)
+static PyObject *Context_get_devname_unlocked(ContextObject *self)
 {
 	return PyObjectResultStr(fdisk_get_devname(self->cxt));
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_devname,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static PyObject *Context_get_label(ContextObject *self)
+static PyObject *Context_get_label_unlocked(ContextObject *self)
 {
 	struct fdisk_context *cxt = self->cxt;
 
-	if (fdisk_has_label(cxt)) {
-		return PyObjectResultLabel(fdisk_get_label(cxt, NULL));
+	if (Context_has_label(self)) {
+		return PyObjectResultLabel(self->st, cxt,
+					   fdisk_get_label(cxt, NULL));
 	} else {
 		Py_RETURN_NONE;
 	}
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_label,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static PyObject *Context_get_nparts(ContextObject *self)
+static PyObject *Context_get_nparts_unlocked(ContextObject *self)
 {
 	return PyLong_FromLong(fdisk_table_get_nents(self->tb));
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_nparts,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static PyObject *Context_get_partitions(ContextObject *self)
+static PyObject *Context_get_partitions_unlocked(ContextObject *self)
 {
+	ModuleState *st = self->st;
 	PyObject *p, *list = PyList_New(0); /* XXX: null if failed*/
 	struct fdisk_partition *pa;
-	struct fdisk_iter *itr;
 	struct fdisk_table *tb;
 	/* char *data; */
 	
 	tb = self->tb;
-	itr = fdisk_new_iter(FDISK_ITER_FORWARD);
+	if (!self->itr && !(self->itr = fdisk_new_iter(FDISK_ITER_FORWARD)))
+		return list;
+	fdisk_reset_iter(self->itr, FDISK_ITER_FORWARD);
 
-	while(fdisk_table_next_partition(tb, itr, &pa) == 0) {
+	while(fdisk_table_next_partition(tb, self->itr, &pa) == 0) {
 		/* const char *name = fdisk_partition_get_name(pa);*/
-		p = PyObjectResultPartition(pa);
+		p = PyObjectResultPartition(st, pa, self);
 		PyList_Append(list, p);
+		Py_XDECREF(p);
 		/*free(data);*/
 	}	
 
-	fdisk_free_iter(itr);
-
 	return list;
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_partitions,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static PyObject *Context_get_size_unit(ContextObject *self)
+static PyObject *Context_get_size_unit_unlocked(ContextObject *self)
 {
 	return PyLong_FromLong(fdisk_get_size_unit(self->cxt));
 }
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_size_unit,
+	       (ContextObject *self, void *closure),
+	       (self))
 
-static int Context_set_size_unit(ContextObject *self, PyObject *value, void *closure)
+static int Context_set_size_unit_unlocked(ContextObject *self, PyObject *value, void *closure)
 {
 	int szunit;
 
@@ -295,6 +1149,39 @@ static int Context_set_size_unit(ContextObject *self, PyObject *value, void *clo
 
 	return 0;
 }
+CONTEXT_LOCKED(int, -1, Context_set_size_unit,
+	       (ContextObject *self, PyObject *value, void *closure),
+	       (self, value, closure))
+
+static PyObject *Context_get_grain_size_unlocked(ContextObject *self)
+{
+	if (!self->cxt) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	return PyLong_FromUnsignedLong(fdisk_get_grain_size(self->cxt));
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_grain_size,
+	       (ContextObject *self, void *closure),
+	       (self))
+
+static PyObject *Context_get_alignment_offset_unlocked(ContextObject *self)
+{
+	if (!self->cxt) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	return PyLong_FromUnsignedLong(fdisk_get_alignment_offset(self->cxt));
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_get_alignment_offset,
+	       (ContextObject *self, void *closure),
+	       (self))
+
+/* Set once by nested(), no lock needed */
+static PyObject *Context_get_parent(ContextObject *self, void *closure)
+{
+	return Py_NewRef(self->parent ? self->parent : Py_None);
+}
 
 static PyGetSetDef Context_getseters[] = {
 	{"nsectors",	(getter)Context_get_nsectors, NULL, "context number of sectors", NULL},
@@ -304,43 +1191,65 @@ static PyGetSetDef Context_getseters[] = {
 	{"nparts",	(getter)Context_get_nparts, NULL, "context label number of existing partitions", NULL},
 	{"partitions",	(getter)Context_get_partitions, NULL, "context partitions", NULL},
 	{"size_unit",	(getter)Context_get_size_unit, (setter)Context_set_size_unit, "context unit size", NULL},
+	{"grain_size",	(getter)Context_get_grain_size, NULL, "context alignment grain in bytes", NULL},
+	{"alignment_offset",	(getter)Context_get_alignment_offset, NULL, "context alignment offset in bytes", NULL},
+	{"parent",	(getter)Context_get_parent, NULL, "context this one is nested in, or None", NULL},
 	{NULL}
 };
 
-static PyObject *Context_repr(ContextObject *self)
-{
-	PyObject *lbo = Py_None;
-
-	if (fdisk_has_label(self->cxt))
-		lbo = PyObjectResultLabel(fdisk_get_label(self->cxt, NULL));
-
-	return PyUnicode_FromFormat("<libfdisk.Context object at %p, label=%R, details=%s, readonly=%s>",
-				    self,
-				    lbo,
-				    fdisk_is_details(self->cxt) ? "True" : "False",
-				    fdisk_is_readonly(self->cxt) ? "True" : "False");
-}
-
-PyTypeObject ContextType = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "libfdisk.Context",
-	.tp_basicsize = sizeof(ContextObject),
-	.tp_dealloc = (destructor)Context_dealloc,
-	.tp_repr = (reprfunc) Context_repr,
-	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-	.tp_doc = Context_HELP,
-	.tp_methods = Context_methods,
-	.tp_members = Context_members,
-	.tp_getset = Context_getseters,
-	.tp_init = (initproc)Context_init,
-	.tp_new = Context_new,
+static PyObject *Context_repr_unlocked(ContextObject *self)
+{
+	PyObject *lbo = Py_NewRef(Py_None), *ret;
+
+	if (Context_has_label(self)) {
+		Py_DECREF(lbo);
+		lbo = PyObjectResultLabel(self->st, self->cxt,
+					  fdisk_get_label(self->cxt, NULL));
+		if (!lbo)
+			return NULL;
+	}
+
+	ret = PyUnicode_FromFormat("<libfdisk.Context object at %p, label=%R, details=%s, readonly=%s>",
+				   self,
+				   lbo,
+				   fdisk_is_details(self->cxt) ? "True" : "False",
+				   fdisk_is_readonly(self->cxt) ? "True" : "False");
+	Py_DECREF(lbo);
+	return ret;
+}
+CONTEXT_LOCKED(PyObject *, NULL, Context_repr,
+	       (ContextObject *self),
+	       (self))
+
+static PyType_Slot Context_slots[] = {
+	{Py_tp_dealloc, Context_dealloc},
+	{Py_tp_traverse, Context_traverse},
+	{Py_tp_clear, Context_clear},
+	{Py_tp_repr, Context_repr},
+	{Py_tp_doc, Context_HELP},
+	{Py_tp_methods, Context_methods},
+	{Py_tp_members, Context_members},
+	{Py_tp_getset, Context_getseters},
+	{Py_tp_init, Context_init},
+	{Py_tp_new, Context_new},
+	{0, NULL}
+};
+
+static PyType_Spec Context_spec = {
+	.name = "libfdisk.Context",
+	.basicsize = sizeof(ContextObject),
+	.flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE |
+		 Py_TPFLAGS_HAVE_GC,
+	.slots = Context_slots,
 };
 
-void Context_AddModuleObject(PyObject *mod)
+int Context_AddModuleObject(PyObject *mod, ModuleState *st)
 {
-	if (PyType_Ready(&ContextType) < 0)
-		return;
+	st->ContextType = (PyTypeObject *) PyType_FromModuleAndSpec(mod, &Context_spec, NULL);
+	if (!st->ContextType)
+		return -1;
+	/* there is no Py_tp_vectorcall slot before Python 3.14 */
+	st->ContextType->tp_vectorcall = Context_vectorcall;
 
-	Py_INCREF(&ContextType);
-	PyModule_AddObject(mod, "Context", (PyObject *)&ContextType);
+	return PyModule_AddType(mod, st->ContextType);
 }
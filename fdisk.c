@@ -45,43 +45,318 @@ PyObject *PyObjectResultStr(const char *s)
 	return result;
 }
 
+/*
+ * Resolve the arguments of a METH_FASTCALL | METH_KEYWORDS call or of a
+ * vectorcall into @out, one slot per @kwlist entry. Empty names in @kwlist
+ * are positional-only, entries at or beyond @maxpos are keyword-only and
+ * the first @required entries must be given. Slots not passed are left
+ * untouched. Returns 0 on success, -1 with TypeError set otherwise.
+ */
+int unpack_fastcall_args(PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+			 const char * const *kwlist, Py_ssize_t maxpos,
+			 Py_ssize_t required, PyObject **out)
+{
+	Py_ssize_t i, j, nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+
+	if (nargs > maxpos)
+		goto err;
+	for (i = 0; i < nargs; i++)
+		out[i] = args[i];
+
+	for (i = 0; i < nkw; i++) {
+		const char *key = PyUnicode_AsUTF8(PyTuple_GET_ITEM(kwnames, i));
+
+		if (!key)
+			return -1;
+		for (j = 0; kwlist[j]; j++) {
+			if (*kwlist[j] && strcmp(kwlist[j], key) == 0)
+				break;
+		}
+		if (!kwlist[j] || j < nargs)
+			goto err;
+		out[j] = args[nargs + i];
+	}
+
+	for (i = 0; i < required; i++) {
+		if (!out[i])
+			goto err;
+	}
+	return 0;
+err:
+	PyErr_SetString(PyExc_TypeError, ARG_ERR);
+	return -1;
+}
+
+/*
+ * Generic tp_new + tp_init construction for types whose tp_vectorcall only
+ * handles the exact type (i.e. Python subclasses).
+ */
+PyObject *vectorcall_type_call(PyObject *type, PyObject *const *args,
+			       size_t nargsf, PyObject *kwnames)
+{
+	Py_ssize_t i, nargs = PyVectorcall_NARGS(nargsf);
+	PyObject *tuple, *kwds = NULL, *ret = NULL;
+
+	tuple = PyTuple_New(nargs);
+	if (!tuple)
+		return NULL;
+	for (i = 0; i < nargs; i++) {
+		Py_INCREF(args[i]);
+		PyTuple_SET_ITEM(tuple, i, args[i]);
+	}
+
+	if (kwnames && PyTuple_GET_SIZE(kwnames)) {
+		kwds = PyDict_New();
+		if (!kwds)
+			goto out;
+		for (i = 0; i < PyTuple_GET_SIZE(kwnames); i++) {
+			if (PyDict_SetItem(kwds, PyTuple_GET_ITEM(kwnames, i), args[nargs + i]) < 0)
+				goto out;
+		}
+	}
+
+	ret = PyType_Type.tp_call(type, tuple, kwds);
+out:
+	Py_DECREF(tuple);
+	Py_XDECREF(kwds);
+	return ret;
+}
+
+/*
+ * Return a new reference to an object of @type, reusing a cached one from
+ * @fl when available. Unlike tp_alloc the object is not zeroed: callers
+ * must initialize every field.
+ */
+PyObject *freelist_alloc(struct freelist *fl, PyTypeObject *type)
+{
+#ifndef Py_GIL_DISABLED
+	if (fl->nitems) {
+		fl->hits++;
+		return PyObject_Init(fl->items[--fl->nitems], type);
+	}
+	fl->misses++;
+#endif
+	return PyObject_New(PyObject, type);
+}
+
+/*
+ * Called from tp_dealloc. Returns 1 if @op was cached in @fl, in which case
+ * the caller must not free it (but still drops its reference to the type,
+ * freelist_alloc() takes a new one).
+ */
+int freelist_release(struct freelist *fl, PyObject *op)
+{
+#ifndef Py_GIL_DISABLED
+	if (fl->nitems < FREELIST_MAXLEN) {
+		fl->items[fl->nitems++] = op;
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+void freelist_clear(struct freelist *fl)
+{
+	while (fl->nitems)
+		PyObject_Free(fl->items[--fl->nitems]);
+}
+
+static PyObject *freelist_info(struct freelist *fl)
+{
+	unsigned long long total = fl->hits + fl->misses;
+
+	return Py_BuildValue("{s:K,s:K,s:i,s:d}",
+			     "hits", fl->hits,
+			     "misses", fl->misses,
+			     "cached", fl->nitems,
+			     "hit_rate", total ? (double) fl->hits / total : 0.0);
+}
+
+#define Fdisk_freelist_stats_HELP "freelist_stats(reset=False)\n\n" \
+	"Return a dict with the hit/miss counters of the Partition, PartType " \
+	"and Label object caches. If reset is True the counters are zeroed " \
+	"after reading them."
+static PyObject *Fdisk_freelist_stats(PyObject *mod, PyObject *const *args,
+				      Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "reset", NULL };
+	ModuleState *st = get_module_state(mod);
+	struct freelist *lists[] = {
+		&st->partition_freelist, &st->parttype_freelist, &st->label_freelist
+	};
+	static const char *names[] = { "Partition", "PartType", "Label" };
+	PyObject *argv[1] = { NULL }, *ret, *info;
+	int reset = 0;
+	size_t i;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 1, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && (reset = PyObject_IsTrue(argv[0])) < 0)
+		return NULL;
+
+	ret = PyDict_New();
+	if (!ret)
+		return NULL;
+
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+		info = freelist_info(lists[i]);
+		if (!info || PyDict_SetItemString(ret, names[i], info) < 0) {
+			Py_XDECREF(info);
+			Py_DECREF(ret);
+			return NULL;
+		}
+		Py_DECREF(info);
+		if (reset)
+			lists[i]->hits = lists[i]->misses = 0;
+	}
+
+	return ret;
+}
+
+#define Fdisk_live_objects_HELP "live_objects()\n\n" \
+	"Return a dict with the number of Context, Partition, Label and " \
+	"PartType objects alive, each holding a libfdisk reference. Useful " \
+	"to spot leaks in long running processes."
+static PyObject *Fdisk_live_objects(PyObject *mod, PyObject *Py_UNUSED(ignored))
+{
+	ModuleState *st = get_module_state(mod);
+
+	return Py_BuildValue("{s:n,s:n,s:n,s:n}",
+			     "Context", __atomic_load_n(&st->live[LIVE_CONTEXT], __ATOMIC_RELAXED),
+			     "Partition", __atomic_load_n(&st->live[LIVE_PARTITION], __ATOMIC_RELAXED),
+			     "Label", __atomic_load_n(&st->live[LIVE_LABEL], __ATOMIC_RELAXED),
+			     "PartType", __atomic_load_n(&st->live[LIVE_PARTTYPE], __ATOMIC_RELAXED));
+}
+
 static PyMethodDef FdiskMethods[] = {
+	{"freelist_stats",	(PyCFunction)(void(*)(void))Fdisk_freelist_stats, METH_FASTCALL | METH_KEYWORDS, Fdisk_freelist_stats_HELP},
+	{"live_objects",	(PyCFunction)Fdisk_live_objects, METH_NOARGS, Fdisk_live_objects_HELP},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
-static struct PyModuleDef fdiskmodule = {
-    PyModuleDef_HEAD_INIT,
-    "fdisk",   /* name of module */
-    NULL, /* module documentation, may be NULL */
-    -1,       /* size of per-interpreter state of the module,
-                 or -1 if the module keeps state in global variables. */
-    FdiskMethods
-};
+static int fdisk_exec(PyObject *m)
+{
+	ModuleState *st = get_module_state(m);
+	PyObject *array;
 
-PyMODINIT_FUNC
-PyInit_fdisk(void)
+	if (PyModule_AddIntConstant(m, "FDISK_SIZEUNIT_BYTES", FDISK_SIZEUNIT_BYTES) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_SIZEUNIT_HUMAN", FDISK_SIZEUNIT_HUMAN) < 0 ||
+
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_DEVICE", FDISK_FIELD_DEVICE) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_START", FDISK_FIELD_START) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_END", FDISK_FIELD_END) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_SECTORS", FDISK_FIELD_SECTORS) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_CYLINDERS", FDISK_FIELD_CYLINDERS) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_SIZE", FDISK_FIELD_SIZE) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_TYPE", FDISK_FIELD_TYPE) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_TYPEID", FDISK_FIELD_TYPEID) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_ATTR", FDISK_FIELD_ATTR) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_BOOT", FDISK_FIELD_BOOT) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_BSIZE", FDISK_FIELD_BSIZE) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_CPG", FDISK_FIELD_CPG) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_EADDR", FDISK_FIELD_EADDR) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_FSIZE", FDISK_FIELD_FSIZE) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_NAME", FDISK_FIELD_NAME) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_SADDR", FDISK_FIELD_SADDR) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_UUID", FDISK_FIELD_UUID) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_FSUUID", FDISK_FIELD_FSUUID) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_FSLABEL", FDISK_FIELD_FSLABEL) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_FIELD_FSTYPE", FDISK_FIELD_FSTYPE) < 0 ||
+
+	    PyModule_AddIntConstant(m, "FDISK_DISKLABEL_DOS", FDISK_DISKLABEL_DOS) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_DISKLABEL_GPT", FDISK_DISKLABEL_GPT) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_ITER_FORWARD", FDISK_ITER_FORWARD) < 0 ||
+	    PyModule_AddIntConstant(m, "FDISK_ITER_BACKWARD", FDISK_ITER_BACKWARD) < 0)
+		return -1;
+
+	log_init(st);
+
+	if (!(array = PyImport_ImportModule("array")))
+		return -1;
+	st->array_type = PyObject_GetAttrString(array, "array");
+	Py_DECREF(array);
+	if (!st->array_type)
+		return -1;
+
+	if (PyModule_AddFunctions(m, Stats_methods) < 0 ||
+	    PyModule_AddFunctions(m, Log_methods) < 0 ||
+	    PyModule_AddFunctions(m, Verify_methods) < 0)
+		return -1;
+
+	if (Context_AddModuleObject(m, st) < 0 ||
+	    Label_AddModuleObject(m, st) < 0 ||
+	    Partition_AddModuleObject(m, st) < 0 ||
+	    PartType_AddModuleObject(m, st) < 0 ||
+	    ContextPool_AddModuleObject(m, st) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int fdisk_traverse(PyObject *m, visitproc visit, void *arg)
 {
-	PyObject *m = PyModule_Create(&fdiskmodule);
+	ModuleState *st = get_module_state(m);
 
-	PyModule_AddIntConstant(m, "FDISK_SIZEUNIT_BYTES", FDISK_SIZEUNIT_BYTES);
-	PyModule_AddIntConstant(m, "FDISK_SIZEUNIT_HUMAN", FDISK_SIZEUNIT_HUMAN);
+	Py_VISIT(st->ContextType);
+	Py_VISIT(st->PartitionType);
+	Py_VISIT(st->PartTypeType);
+	Py_VISIT(st->LabelType);
+	Py_VISIT(st->ContextPoolType);
+	Py_VISIT(st->logger);
+	Py_VISIT(st->array_type);
+	return 0;
+}
 
-	PyModule_AddIntConstant(m, "FDISK_FIELD_DEVICE", FDISK_FIELD_DEVICE);
-	PyModule_AddIntConstant(m, "FDISK_FIELD_SIZE", FDISK_FIELD_SIZE);
-	PyModule_AddIntConstant(m, "FDISK_FIELD_TYPE", FDISK_FIELD_TYPE);
-	PyModule_AddIntConstant(m, "FDISK_FIELD_TYPEID", FDISK_FIELD_TYPEID);
-	PyModule_AddIntConstant(m, "FDISK_FIELD_FSTYPE", FDISK_FIELD_FSTYPE);
+static int fdisk_clear(PyObject *m)
+{
+	ModuleState *st = get_module_state(m);
 
-	PyModule_AddIntConstant(m, "FDISK_DISKLABEL_DOS", FDISK_DISKLABEL_DOS);
-	PyModule_AddIntConstant(m, "FDISK_DISKLABEL_GPT", FDISK_DISKLABEL_GPT);
-	PyModule_AddIntConstant(m, "FDISK_ITER_FORWARD", FDISK_ITER_FORWARD);
-	PyModule_AddIntConstant(m, "FDISK_ITER_BACKWARD", FDISK_ITER_BACKWARD);
+	Py_CLEAR(st->ContextType);
+	Py_CLEAR(st->PartitionType);
+	Py_CLEAR(st->PartTypeType);
+	Py_CLEAR(st->LabelType);
+	Py_CLEAR(st->ContextPoolType);
+	Py_CLEAR(st->logger);
+	Py_CLEAR(st->array_type);
+	return 0;
+}
 
-	Context_AddModuleObject(m);
-	Label_AddModuleObject(m);
-	Partition_AddModuleObject(m);
-	PartType_AddModuleObject(m);
+static void fdisk_free(void *m)
+{
+	ModuleState *st = get_module_state((PyObject *) m);
 
+	fdisk_clear((PyObject *) m);
+	freelist_clear(&st->partition_freelist);
+	freelist_clear(&st->parttype_freelist);
+	freelist_clear(&st->label_freelist);
+	log_destroy(st);
+}
+
+static PyModuleDef_Slot fdisk_slots[] = {
+	{Py_mod_exec, fdisk_exec},
+#ifdef Py_mod_multiple_interpreters
+	{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+	{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+	{0, NULL}
+};
 
-	return m;
+struct PyModuleDef fdiskmodule = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "fdisk",
+    .m_doc = NULL,
+    .m_size = sizeof(ModuleState),
+    .m_methods = FdiskMethods,
+    .m_slots = fdisk_slots,
+    .m_traverse = fdisk_traverse,
+    .m_clear = fdisk_clear,
+    .m_free = fdisk_free,
+};
+
+PyMODINIT_FUNC
+PyInit_fdisk(void)
+{
+	return PyModuleDef_Init(&fdiskmodule);
 }
@@ -16,47 +16,356 @@
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <structmember.h>
+#include <pthread.h>
 
 #include <libfdisk/libfdisk.h>
 
 #define CONSTRUCT_ERR	"Error during object construction"
 #define ARG_ERR		"Invalid number or type of arguments"
 
-typedef struct {
-	PyObject_HEAD
-	struct fdisk_context		*cxt;
-	struct fdisk_table		*tb;
-} ContextObject;
 
 typedef struct {
 	PyObject_HEAD
 	struct fdisk_label		*lb;
+	struct fdisk_context		*cxt;	/* owner of lb, referenced */
 } LabelObject;
 
 typedef struct {
 	PyObject_HEAD
 	struct fdisk_partition		*pa;
+	PyObject			*owner;	/* Context whose table holds pa */
 } PartitionObject;
 
+/*
+ * Partitions are guarded by a per-object critical section on free-threaded
+ * builds (3.13+); with the GIL these compile to a plain block.
+ */
+#ifndef Py_BEGIN_CRITICAL_SECTION
+# define Py_BEGIN_CRITICAL_SECTION(op)	{
+# define Py_END_CRITICAL_SECTION()	}
+#endif
+
 typedef struct {
 	PyObject_HEAD
 	struct fdisk_parttype		*type;
 } PartTypeObject;
 
-extern PyTypeObject ContextType;
-extern PyTypeObject PartitionType;
-extern PyTypeObject PartTypeType;
+/*
+ * Cache of deallocated wrapper objects of one exact type. Result wrappers
+ * (partitions, parttypes, labels) are short lived, so reusing their memory
+ * avoids an allocator round trip per result. Only touched with the GIL held;
+ * free-threaded builds bypass it.
+ */
+#define FREELIST_MAXLEN	256
+
+struct freelist {
+	PyObject		*items[FREELIST_MAXLEN];
+	int			nitems;
+	unsigned long long	hits;
+	unsigned long long	misses;
+};
+
+/*
+ * Bounded buffer of libfdisk info/warning messages waiting to be passed to
+ * the Python logger configured with fdisk.set_debug(), see ask.c. Filled
+ * from the ask callback, possibly without the GIL; drained in batches
+ * with the GIL held.
+ */
+#define LOG_RING_SIZE	256
+#define LOG_MSG_MAX	256
+
+struct log_entry {
+	int		level;			/* Python logging level */
+	char		msg[LOG_MSG_MAX];
+};
+
+struct log_ring {
+	pthread_mutex_t		lock;
+	int			threshold;	/* lowest level logged */
+	unsigned int		head;
+	unsigned int		count;
+	unsigned long		dropped;
+	struct log_entry	entries[LOG_RING_SIZE];
+};
+
+/* Per-interpreter module state */
+enum {
+	LIVE_CONTEXT,
+	LIVE_PARTITION,
+	LIVE_LABEL,
+	LIVE_PARTTYPE,
+	LIVE_NTYPES
+};
 
-extern void Context_AddModuleObject(PyObject *mod);
-extern void Label_AddModuleObject(PyObject *mod);
-extern void Partition_AddModuleObject(PyObject *mod);
-extern void PartType_AddModuleObject(PyObject *mod);
+typedef struct {
+	PyTypeObject		*ContextType;
+	PyTypeObject		*PartitionType;
+	PyTypeObject		*PartTypeType;
+	PyTypeObject		*LabelType;
+	PyTypeObject		*ContextPoolType;
+
+	struct freelist		partition_freelist;
+	struct freelist		parttype_freelist;
+	struct freelist		label_freelist;
+
+	PyObject		*logger;
+	struct log_ring		log;
+
+	PyObject		*array_type;	/* array.array, for Context.align() */
+
+	Py_ssize_t		live[LIVE_NTYPES];
+} ModuleState;
+
+/* Count wrapper objects alive, for fdisk.live_objects() */
+#define LIVE_INC(st, t)	__atomic_add_fetch(&(st)->live[t], 1, __ATOMIC_RELAXED)
+#define LIVE_DEC(st, t)	__atomic_sub_fetch(&(st)->live[t], 1, __ATOMIC_RELAXED)
+
+/* Problems found by fdisk_verify_disklabel(), see verify.c */
+enum {
+	VERIFY_OVERLAP,
+	VERIFY_ALIGNMENT,
+	VERIFY_CHECKSUM,
+	VERIFY_RANGE,
+	VERIFY_OTHER,
+};
+
+struct verify_problem {
+	int		kind;
+	long		partno;			/* -1 if not about one partition */
+	char		msg[LOG_MSG_MAX];
+};
+
+struct verify_sink {
+	struct verify_problem	*items;
+	size_t			n;
+	size_t			alloc;
+	void			*chain;		/* ContextObject for other messages */
+	int			forward;	/* pass warnings to chain too */
+};
+
+/* Precomputed dialog answers for Context.set_answers(), see ask.c */
+enum {
+	ANSWER_UNSET,
+	ANSWER_DEFAULT,		/* what libfdisk proposes */
+	ANSWER_LOW,		/* lowest number allowed */
+	ANSWER_HIGH,		/* highest number allowed */
+	ANSWER_VALUE,		/* number, yes/no or menu key */
+	ANSWER_STRING,
+};
+
+struct ask_answer {
+	int		how;
+	uint64_t	value;
+	char		*string;
+};
+
+struct ask_override {
+	char			*query;		/* substring of the question */
+	int			type;		/* FDISK_ASKTYPE_* answered */
+	struct ask_answer	answer;
+};
+
+struct ask_answers {
+	struct ask_answer	yesno;
+	struct ask_answer	number;		/* FDISK_ASKTYPE_NUMBER and _OFFSET */
+	struct ask_answer	string;
+	struct ask_answer	menu;
+	struct ask_override	*overrides;
+	size_t			noverrides;
+};
+
+/* How to wipe a new partition, see wipe.c */
+enum {
+	WIPE_NONE,
+	WIPE_SIGNATURES,	/* libfdisk signature wipe on write */
+	WIPE_DISCARD,		/* signatures + BLKDISCARD after write */
+	WIPE_ZEROOUT,		/* BLKZEROOUT after write */
+};
+
+struct pending_wipe {
+	size_t		partno;
+	int		mode;
+};
+
+typedef struct {
+	PyObject_HEAD
+	struct fdisk_context		*cxt;
+	struct fdisk_table		*tb;
+	struct fdisk_iter		*itr;	/* reused by .partitions */
+	struct pending_wipe		*wipes;	/* added since last write */
+	size_t				nwipes;
+	struct verify_sink		probe;	/* warnings probing the label */
+	struct ask_answers		*answers; /* NULL to fail dialogs */
+	ModuleState			*st;	/* state of the defining module */
+	PyObject			*parent; /* Context nested into, or NULL */
+	Py_ssize_t			nchildren; /* nested contexts alive */
+	int				released; /* given back to a ContextPool */
+	pthread_mutex_t			lock;	/* unused if nested, see root */
+	unsigned long			owner;	/* thread holding lock */
+} ContextObject;
+
+/*
+ * Nested contexts (Context.nested()) use the parent's device through the
+ * same libfdisk state, so the whole tree shares the lock of the outermost
+ * parent.
+ */
+static inline ContextObject *Context_root(ContextObject *self)
+{
+	while (self->parent)
+		self = (ContextObject *) self->parent;
+	return self;
+}
+
+extern struct PyModuleDef fdiskmodule;
+
+static inline ModuleState *get_module_state(PyObject *mod)
+{
+	return (ModuleState *) PyModule_GetState(mod);
+}
+
+/* Module state of an instance of (a subclass of) one of our types */
+static inline ModuleState *get_type_state(PyTypeObject *type)
+{
+	return get_module_state(PyType_GetModuleByDef(type, &fdiskmodule));
+}
+
+/*
+ * libfdisk contexts are not thread safe. Every Context entry point holds
+ * the context lock, which is acquired without the GIL on contention so a
+ * thread waiting for it never blocks the owner from reacquiring the GIL.
+ * Reentering the same context from its owner thread (e.g. from a callback)
+ * raises RuntimeError instead of deadlocking.
+ */
+static inline int Context_lock(ContextObject *self)
+{
+	unsigned long tid = PyThread_get_thread_ident();
+
+	self = Context_root(self);
+	/* only equal to tid if set by this thread, a relaxed load is enough */
+	if (__atomic_load_n(&self->owner, __ATOMIC_RELAXED) == tid) {
+		PyErr_SetString(PyExc_RuntimeError, "reentrant call into Context");
+		return -1;
+	}
+	if (pthread_mutex_trylock(&self->lock) != 0) {
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&self->lock);
+		Py_END_ALLOW_THREADS
+	}
+	__atomic_store_n(&self->owner, tid, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static inline void Context_unlock(ContextObject *self)
+{
+	self = Context_root(self);
+	__atomic_store_n(&self->owner, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * Operation counters and latency histograms (stats.c). Wrap each libfdisk
+ * call of interest as
+ *
+ *	uint64_t t0 = STATS_BEGIN();
+ *	rc = fdisk_foo(...);
+ *	STATS_END(STAT_FOO, t0, rc);
+ *
+ * which is a single predictable branch while collection is disabled.
+ */
+enum {
+	STAT_ASSIGN_DEVICE,
+	STAT_GET_PARTITIONS,
+	STAT_WRITE_DISKLABEL,
+	STAT_ADD_PARTITION,
+	STAT_WIPE,		/* discard/zeroout of one partition */
+	STAT_PARTTYPE_LOOKUP,
+	STAT_VERIFY,
+	STAT_NOPS
+};
+
+#define STATS_NBUCKETS	40
+
+extern int stats_enabled_flag;
+extern uint64_t stats_now(void);
+extern void stats_record(int op, uint64_t start, int rc);
+extern PyMethodDef Stats_methods[];
+
+#define STATS_BEGIN() \
+	(__atomic_load_n(&stats_enabled_flag, __ATOMIC_RELAXED) ? stats_now() : 0)
+#define STATS_END(op, start, rc) \
+	do { if (start) stats_record((op), (start), (rc)); } while (0)
+
+/*
+ * USDT probes for bpftrace/perf/systemtap, provider "pylibfdisk". Every probe
+ * has the same arguments: device (or label) name, partition number (-1 if
+ * not applicable) and libfdisk return code (0 on entry probes), e.g.
+ *
+ *	bpftrace -e 'usdt:./fdisk.*.so:pylibfdisk:write_disklabel_return
+ *		     { printf("%s rc=%d\n", str(arg0), arg2); }'
+ *
+ * Probes compile to a single nop when <sys/sdt.h> is available at build
+ * time, and to nothing otherwise.
+ */
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define USDT_PROBE(name, dev, partno, rc) \
+	DTRACE_PROBE3(pylibfdisk, name, (const char *) (dev), (long) (partno), (int) (rc))
+#else
+# define USDT_PROBE(name, dev, partno, rc) do { } while (0)
+#endif
+
+extern int wipe_mode_from_object(PyObject *obj, int *mode);
+extern int wipe_range(int fd, int regfile, int mode, uint64_t offset, uint64_t len);
+
+extern int verify_ask_cb(struct fdisk_context *cxt, struct fdisk_ask *ask, void *data);
+extern int verify_context(struct fdisk_context *cxt, struct verify_sink *sink);
+extern void verify_sink_free(struct verify_sink *sink);
+extern PyObject *verify_sink_to_list(struct verify_sink *sink);
+extern PyMethodDef Verify_methods[];
+
+extern int Context_ask_cb(struct fdisk_context *cxt, struct fdisk_ask *ask, void *data);
+extern struct ask_answers *answers_from_object(PyObject *obj);
+extern void answers_free(struct ask_answers *answers);
+extern void log_init(ModuleState *st);
+extern void log_destroy(ModuleState *st);
+extern void log_flush(ModuleState *st);
+extern PyMethodDef Log_methods[];
+
+/* Pass messages queued by the ask callback to the logger, if any */
+static inline void log_flush_pending(ModuleState *st)
+{
+	if (__atomic_load_n(&st->log.count, __ATOMIC_RELAXED))
+		log_flush(st);
+}
+
+extern ContextObject *Context_alloc(PyTypeObject *type);
+extern int Context_setup(ContextObject *self, const char *device, int details, int readonly);
+extern int Context_release_device(ContextObject *self, int nosync);
+extern int Context_check_device(ContextObject *self);
+
+extern int Context_AddModuleObject(PyObject *mod, ModuleState *st);
+extern int ContextPool_AddModuleObject(PyObject *mod, ModuleState *st);
+extern int Label_AddModuleObject(PyObject *mod, ModuleState *st);
+extern int Partition_AddModuleObject(PyObject *mod, ModuleState *st);
+extern int PartType_AddModuleObject(PyObject *mod, ModuleState *st);
 
 extern PyObject *PyObjectResultStr(const char *s);
-extern PyObject *PyObjectResultLabel(struct fdisk_label *lb);
-extern PyObject *PyObjectResultPartition(struct fdisk_partition *pa);
-extern PyObject *PyObjectResultPartType(struct fdisk_parttype *t);
+extern PyObject *PyObjectResultLabel(ModuleState *st, struct fdisk_context *cxt,
+				     struct fdisk_label *lb);
+extern PyObject *PyObjectResultPartition(ModuleState *st, struct fdisk_partition *pa,
+					 ContextObject *owner);
+extern PyObject *PyObjectResultPartType(ModuleState *st, struct fdisk_parttype *t);
+
+extern PyObject *freelist_alloc(struct freelist *fl, PyTypeObject *type);
+extern int freelist_release(struct freelist *fl, PyObject *op);
+extern void freelist_clear(struct freelist *fl);
 
 extern void *set_PyErr_from_rc(int err);
+extern int unpack_fastcall_args(PyObject *const *args, Py_ssize_t nargs,
+				PyObject *kwnames, const char * const *kwlist,
+				Py_ssize_t maxpos, Py_ssize_t required,
+				PyObject **out);
+extern PyObject *vectorcall_type_call(PyObject *type, PyObject *const *args,
+				      size_t nargsf, PyObject *kwnames);
 
 #endif
@@ -18,7 +18,16 @@ static PyMemberDef Label_members[] = {
 
 static void Label_dealloc(LabelObject *self)
 {
-	Py_TYPE(self)->tp_free((PyObject *) self);
+	PyTypeObject *tp = Py_TYPE(self);
+	ModuleState *st = get_type_state(tp);
+
+	if (self->cxt)
+		fdisk_unref_context(self->cxt);
+	LIVE_DEC(st, LIVE_LABEL);
+	if (!(tp == st->LabelType &&
+	      freelist_release(&st->label_freelist, (PyObject *) self)))
+		tp->tp_free((PyObject *) self);
+	Py_DECREF(tp);
 }
 
 static PyObject *Label_new(PyTypeObject *type,
@@ -29,6 +38,8 @@ static PyObject *Label_new(PyTypeObject *type,
 
 	if (self) {
 		self->lb = NULL;
+		self->cxt = NULL;
+		LIVE_INC(get_type_state(type), LIVE_LABEL);
 	}
 
 	return (PyObject *)self;
@@ -38,36 +49,80 @@ static PyObject *Label_new(PyTypeObject *type,
 static int Label_init(LabelObject *self, PyObject *args, PyObject *kwds)
 {
 	static char *kwlist[] = { "context", NULL };
+	ModuleState *st = get_type_state(Py_TYPE(self));
 	ContextObject *cxt = NULL;
 	struct fdisk_label *lb;
 	
 	if (!PyArg_ParseTupleAndKeywords(args,
 					kwds, "|O!", kwlist,
-					&ContextType, &cxt)) {
+					st->ContextType, &cxt)) {
 		PyErr_SetString(PyExc_TypeError, "Error");
 		return -1;
 	}
 
-	if (cxt && (lb = fdisk_get_label(cxt->cxt, NULL))) {
+	if (cxt && cxt->cxt && (lb = fdisk_get_label(cxt->cxt, NULL))) {
+		fdisk_ref_context(cxt->cxt);
+		if (self->cxt)
+			fdisk_unref_context(self->cxt);
+		self->cxt = cxt->cxt;
 		self->lb = lb;
 	}
 
 	return 0;
 }
 
+static PyObject *Label_vectorcall(PyObject *type, PyObject *const *args,
+				  size_t nargsf, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "context", NULL };
+	ModuleState *st = get_type_state((PyTypeObject *) type);
+	PyObject *argv[1] = { NULL };
+	struct fdisk_label *lb;
+	LabelObject *self;
+
+	if ((PyTypeObject *) type != st->LabelType)
+		return vectorcall_type_call(type, args, nargsf, kwnames);
+
+	if (unpack_fastcall_args(args, PyVectorcall_NARGS(nargsf), kwnames,
+				 kwlist, 1, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && !PyObject_TypeCheck(argv[0], st->ContextType)) {
+		PyErr_SetString(PyExc_TypeError, "Error");
+		return NULL;
+	}
+
+	self = (LabelObject *) freelist_alloc(&st->label_freelist, st->LabelType);
+	if (!self)
+		return NULL;
+
+	LIVE_INC(st, LIVE_LABEL);
+	self->lb = NULL;
+	self->cxt = argv[0] ? ((ContextObject *) argv[0])->cxt : NULL;
+	if (self->cxt && (lb = fdisk_get_label(self->cxt, NULL))) {
+		fdisk_ref_context(self->cxt);
+		self->lb = lb;
+	} else {
+		self->cxt = NULL;
+	}
+
+	return (PyObject *) self;
+}
+
 #define Label_get_parttype_from_code_HELP "get_parttype_from_code(code)\n\n" \
 	"Search for partition type in label-specific table."
-static PyObject *Label_get_parttype_from_code(LabelObject *self, PyObject *args, PyObject *kwds)
+static PyObject *Label_get_parttype_from_code(LabelObject *self, PyObject *arg)
 {
 	struct fdisk_label *label = self->lb;
 	struct fdisk_parttype *ptype;
 	unsigned int ptype_code;
 	const char *name;
+	uint64_t t0;
 
-	if (!PyArg_ParseTuple(args, "I", &ptype_code)) {
+	if (!PyLong_Check(arg)) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
+	ptype_code = (unsigned int) PyLong_AsUnsignedLongMask(arg);
 
 	if (!fdisk_label_has_code_parttypes(label)) {
 		name = fdisk_label_get_name(label);
@@ -75,25 +130,30 @@ static PyObject *Label_get_parttype_from_code(LabelObject *self, PyObject *args,
 		return NULL;
 	}
 
+	t0 = STATS_BEGIN();
+	USDT_PROBE(parttype_lookup_entry, fdisk_label_get_name(label), -1, 0);
 	ptype = fdisk_label_get_parttype_from_code(label, ptype_code);
+	USDT_PROBE(parttype_lookup_return, fdisk_label_get_name(label), -1,
+		   ptype ? 0 : -ENOENT);
+	STATS_END(STAT_PARTTYPE_LOOKUP, t0, ptype ? 0 : -ENOENT);
 	if (!ptype) {
 		PyErr_Format(PyExc_RuntimeError, "No match for parttype with code: %d", ptype_code);
 		return NULL;
 	}
 
-	return PyObjectResultPartType(ptype);
+	return PyObjectResultPartType(get_type_state(Py_TYPE(self)), ptype);
 }
 
 #define Label_get_parttype_from_string_HELP "get_parttype_from_string(uuid)\n\n" \
 	"Search by string for partition type in label-specific table."
-static PyObject *Label_get_parttype_from_string(LabelObject *self, PyObject *args, PyObject *kwds)
+static PyObject *Label_get_parttype_from_string(LabelObject *self, PyObject *arg)
 {
 	struct fdisk_label *label = self->lb;
 	struct fdisk_parttype *ptype = NULL;
-	const char *name;
-	char *str;
+	const char *name, *str;
+	uint64_t t0;
 
-	if (!PyArg_ParseTuple(args, "s", &str)) {
+	if (!PyUnicode_Check(arg) || !(str = PyUnicode_AsUTF8(arg))) {
 		PyErr_SetString(PyExc_TypeError, ARG_ERR);
 		return NULL;
 	}
@@ -104,18 +164,23 @@ static PyObject *Label_get_parttype_from_string(LabelObject *self, PyObject *arg
 		return NULL;
 	}
 
+	t0 = STATS_BEGIN();
+	USDT_PROBE(parttype_lookup_entry, fdisk_label_get_name(label), -1, 0);
 	ptype = fdisk_label_get_parttype_from_string(label, str);
+	USDT_PROBE(parttype_lookup_return, fdisk_label_get_name(label), -1,
+		   ptype ? 0 : -ENOENT);
+	STATS_END(STAT_PARTTYPE_LOOKUP, t0, ptype ? 0 : -ENOENT);
 	if (!ptype) {
 		PyErr_Format(PyExc_RuntimeError, "No match for parttype with string: %s", str);
 		return NULL;
 	}
 
-	return PyObjectResultPartType(ptype);
+	return PyObjectResultPartType(get_type_state(Py_TYPE(self)), ptype);
 }
 
 static PyMethodDef Label_methods[] = {
-	{"get_parttype_from_code",	(PyCFunction)Label_get_parttype_from_code, METH_VARARGS, Label_get_parttype_from_code_HELP},
-	{"get_parttype_from_string",	(PyCFunction)Label_get_parttype_from_string, METH_VARARGS, Label_get_parttype_from_string_HELP},
+	{"get_parttype_from_code",	(PyCFunction)Label_get_parttype_from_code, METH_O, Label_get_parttype_from_code_HELP},
+	{"get_parttype_from_string",	(PyCFunction)Label_get_parttype_from_string, METH_O, Label_get_parttype_from_string_HELP},
 	{NULL}
 };
 
@@ -141,22 +206,27 @@ static PyObject *Label_repr(LabelObject *self)
 			self, fdisk_label_get_name(self->lb));
 }
 
-PyTypeObject LabelType = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "libfdisk.Label",
-	.tp_basicsize = sizeof(LabelObject),
-	.tp_dealloc = (destructor)Label_dealloc,
-	.tp_repr = (reprfunc) Label_repr,
-	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-	.tp_doc = Label_HELP,
-	.tp_methods = Label_methods,
-	.tp_members = Label_members,
-	.tp_getset = Label_getseters,
-	.tp_init = (initproc)Label_init,
-	.tp_new = Label_new,
+static PyType_Slot Label_slots[] = {
+	{Py_tp_dealloc, Label_dealloc},
+	{Py_tp_repr, Label_repr},
+	{Py_tp_doc, Label_HELP},
+	{Py_tp_methods, Label_methods},
+	{Py_tp_members, Label_members},
+	{Py_tp_getset, Label_getseters},
+	{Py_tp_init, Label_init},
+	{Py_tp_new, Label_new},
+	{0, NULL}
 };
 
-PyObject *PyObjectResultLabel(struct fdisk_label *lb)
+static PyType_Spec Label_spec = {
+	.name = "libfdisk.Label",
+	.basicsize = sizeof(LabelObject),
+	.flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE,
+	.slots = Label_slots,
+};
+
+PyObject *PyObjectResultLabel(ModuleState *st, struct fdisk_context *cxt,
+			      struct fdisk_label *lb)
 {
         LabelObject *result;
 
@@ -166,7 +236,7 @@ PyObject *PyObjectResultLabel(struct fdisk_label *lb)
         }
 
 
-        result = PyObject_New(LabelObject, &LabelType);
+        result = (LabelObject *) freelist_alloc(&st->label_freelist, st->LabelType);
         if (!result) {
                 PyErr_SetString(PyExc_MemoryError, "Couldn't allocate Label object");
                 return NULL;
@@ -174,15 +244,20 @@ PyObject *PyObjectResultLabel(struct fdisk_label *lb)
 
         /* Py_INCREF(result); */
 
+        LIVE_INC(st, LIVE_LABEL);
+        fdisk_ref_context(cxt);
+        result->cxt = cxt;
         result->lb = lb;
         return (PyObject *) result;
 }
 
-void Label_AddModuleObject(PyObject *mod)
+int Label_AddModuleObject(PyObject *mod, ModuleState *st)
 {
-	if (PyType_Ready(&LabelType) < 0)
-		return;
+	st->LabelType = (PyTypeObject *) PyType_FromModuleAndSpec(mod, &Label_spec, NULL);
+	if (!st->LabelType)
+		return -1;
+	/* there is no Py_tp_vectorcall slot before Python 3.14 */
+	st->LabelType->tp_vectorcall = Label_vectorcall;
 
-	Py_INCREF(&LabelType);
-	PyModule_AddObject(mod, "Label", (PyObject *)&LabelType);
+	return PyModule_AddType(mod, st->LabelType);
 }
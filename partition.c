@@ -18,9 +18,17 @@ static PyMemberDef Partition_members[] = {
 
 static void Partition_dealloc(PartitionObject *self)
 {
+	PyTypeObject *tp = Py_TYPE(self);
+	ModuleState *st = get_type_state(tp);
+
 	if (self->pa)
 		fdisk_unref_partition(self->pa);
-	Py_TYPE(self)->tp_free((PyObject *) self);
+	Py_CLEAR(self->owner);
+	LIVE_DEC(st, LIVE_PARTITION);
+	if (!(tp == st->PartitionType &&
+	      freelist_release(&st->partition_freelist, (PyObject *) self)))
+		tp->tp_free((PyObject *) self);
+	Py_DECREF(tp);
 }
 
 static PyObject *Partition_new(PyTypeObject *type,
@@ -29,12 +37,57 @@ static PyObject *Partition_new(PyTypeObject *type,
 {
 	PartitionObject *self = (PartitionObject*) type->tp_alloc(type, 0);
 
-	if (self)
+	if (self) {
 		self->pa = NULL;
+		self->owner = NULL;
+		LIVE_INC(get_type_state(type), LIVE_PARTITION);
+	}
 
 	return (PyObject *)self;
 }
 
+/*
+ * A Partition from Context.partitions shares its fdisk_partition with the
+ * context's table, so besides the object's critical section, accessors
+ * hold the lock of that context (@owner, set once at creation).
+ */
+static int Partition_lock(PartitionObject *self)
+{
+	return self->owner ? Context_lock((ContextObject *) self->owner) : 0;
+}
+
+static void Partition_unlock(PartitionObject *self)
+{
+	if (self->owner)
+		Context_unlock((ContextObject *) self->owner);
+}
+
+static int Partition_setup(PartitionObject *self, int partno_follow_default,
+			   int start_follow_default, int end_follow_default)
+{
+	int rc;
+
+	self->pa = fdisk_new_partition();
+	if (!self->pa) {
+		PyErr_SetString(PyExc_MemoryError, "Couldn't allocate partition");
+		return -1;
+	}
+	if ((rc = fdisk_partition_partno_follow_default(self->pa, partno_follow_default) < 0)) {
+		set_PyErr_from_rc(-rc);
+		return -1;
+	}
+	if ((rc = fdisk_partition_start_follow_default(self->pa, start_follow_default) < 0)) {
+		set_PyErr_from_rc(-rc);
+		return -1;
+	}
+	if ((rc = fdisk_partition_end_follow_default(self->pa, end_follow_default) < 0)) {
+		set_PyErr_from_rc(-rc);
+		return -1;
+	}
+
+	return 0;
+}
+
 #define Partition_HELP 	"Partition(partno_follow_default=False, " \
 			"start_follow_default=False, " \
 			"end_follow_default=False)"
@@ -48,8 +101,9 @@ static int Partition_init(PartitionObject *self, PyObject *args, PyObject *kwds)
 	};
 	int partno_follow_default = 0,
 	    start_follow_default = 0,
-	    end_follow_default = 0,
-	    rc;
+	    end_follow_default = 0;
+	struct fdisk_partition *old;
+	int rc;
 
 	if (!PyArg_ParseTupleAndKeywords(args,
 					kwds, "|ppp", kwlist,
@@ -60,27 +114,61 @@ static int Partition_init(PartitionObject *self, PyObject *args, PyObject *kwds)
 		return -1;
 	}
 
-	self->pa = fdisk_new_partition();
-	if ((rc = fdisk_partition_partno_follow_default(self->pa, partno_follow_default) < 0)) {
-		set_PyErr_from_rc(-rc);
-		return -1;
-	}
-	if ((rc = fdisk_partition_start_follow_default(self->pa, start_follow_default) < 0)) {
-		set_PyErr_from_rc(-rc);
+	if (Partition_lock(self) < 0)
 		return -1;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	old = self->pa;
+	self->pa = NULL;
+	rc = Partition_setup(self, partno_follow_default,
+			     start_follow_default, end_follow_default);
+	Py_END_CRITICAL_SECTION();
+	Partition_unlock(self);
+	if (old)
+		fdisk_unref_partition(old);
+
+	return rc;
+}
+
+static PyObject *Partition_vectorcall(PyObject *type, PyObject *const *args,
+				      size_t nargsf, PyObject *kwnames)
+{
+	static const char * const kwlist[] = {
+		"partno_follow_default",
+		"start_follow_default",
+		"end_follow_default",
+		NULL
+	};
+	ModuleState *st = get_type_state((PyTypeObject *) type);
+	PyObject *argv[3] = { NULL, NULL, NULL };
+	int flags[3] = { 0, 0, 0 }, i;
+	PartitionObject *self;
+
+	if ((PyTypeObject *) type != st->PartitionType)
+		return vectorcall_type_call(type, args, nargsf, kwnames);
+
+	if (unpack_fastcall_args(args, PyVectorcall_NARGS(nargsf), kwnames,
+				 kwlist, 3, 0, argv) < 0)
+		return NULL;
+	for (i = 0; i < 3; i++) {
+		if (argv[i] && (flags[i] = PyObject_IsTrue(argv[i])) < 0)
+			return NULL;
 	}
-	if ((rc = fdisk_partition_end_follow_default(self->pa, end_follow_default) < 0)) {
-		set_PyErr_from_rc(-rc);
-		return -1;
+
+	self = (PartitionObject *) freelist_alloc(&st->partition_freelist, st->PartitionType);
+	if (!self)
+		return NULL;
+
+	LIVE_INC(st, LIVE_PARTITION);
+	self->pa = NULL;
+	self->owner = NULL;
+	if (Partition_setup(self, flags[0], flags[1], flags[2]) < 0) {
+		Py_DECREF(self);
+		return NULL;
 	}
 
-	return 0;
+	return (PyObject *) self;
 }
 
-static PyMethodDef Partition_methods[] = {
-	{NULL}
-};
-
 static PyObject *Partition_get_partno(PartitionObject *self)
 {
 	if (fdisk_partition_has_partno(self->pa)) {
@@ -103,6 +191,8 @@ static int Partition_set_partno(PartitionObject *self, PyObject *value, void *cl
 		return -1;
 	}
 	num = PyLong_AsSize_t(value);
+	if (num == (size_t) -1 && PyErr_Occurred())
+		return -1;
 	if (fdisk_partition_set_partno(self->pa, num) < 0) {
 		PyErr_SetString(PyExc_TypeError,
 				"libfdisk reported error setting partno");
@@ -135,6 +225,8 @@ static int Partition_set_size(PartitionObject *self, PyObject *value, void *clos
 		return -1;
 	}
 	sectors = PyLong_AsUnsignedLongLong(value);
+	if (sectors == (uint64_t) -1 && PyErr_Occurred())
+		return -1;
 	if (fdisk_partition_set_size(self->pa, sectors) < 0) {
 		PyErr_SetString(PyExc_TypeError,
 				"libfdisk reported error setting partition size");
@@ -150,7 +242,7 @@ static PyObject *Partition_get_type(PartitionObject *self)
 
 	t = fdisk_partition_get_type(self->pa);
 	if (t)
-		return PyObjectResultPartType(t);
+		return PyObjectResultPartType(get_type_state(Py_TYPE(self)), t);
 
 	Py_RETURN_NONE;
 }
@@ -159,10 +251,10 @@ static int Partition_set_type(PartitionObject *self, PyObject *value, void *clos
 {
 	if (!value) {
 		PyErr_SetString(PyExc_TypeError,
-				"partition type assertion error");
+				"partition type cannot be unset");
 		return -1;
 	}
-	if (!PyObject_TypeCheck(value, &PartTypeType)) {
+	if (!PyObject_TypeCheck(value, get_type_state(Py_TYPE(self))->PartTypeType)) {
 		PyErr_SetString(PyExc_TypeError,
 				"invalid partition type");
 		return -1;
@@ -176,44 +268,399 @@ static int Partition_set_type(PartitionObject *self, PyObject *value, void *clos
 	return 0;
 }
 
-static PyGetSetDef Partition_getseters[] = {
+static PyObject *Partition_get_start(PartitionObject *self)
+{
+	if (fdisk_partition_has_start(self->pa)) {
+		return PyLong_FromUnsignedLongLong(fdisk_partition_get_start(self->pa));
+	}
+	Py_RETURN_NONE;
+}
+
+static int Partition_set_start(PartitionObject *self, PyObject *value, void *closure)
+{
+	uint64_t sector;
+
+	if (value == NULL) {
+		fdisk_partition_unset_start(self->pa);
+		return 0;
+	}
+
+	if (!PyLong_Check(value)) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return -1;
+	}
+	sector = PyLong_AsUnsignedLongLong(value);
+	if (sector == (uint64_t) -1 && PyErr_Occurred())
+		return -1;
+	if (fdisk_partition_set_start(self->pa, sector) < 0) {
+		PyErr_SetString(PyExc_TypeError,
+				"libfdisk reported error setting partition start");
+		return -1;
+	}
+
+	return 0;
+}
+
+static PyObject *Partition_get_end(PartitionObject *self)
+{
+	if (fdisk_partition_has_end(self->pa)) {
+		return PyLong_FromUnsignedLongLong(fdisk_partition_get_end(self->pa));
+	}
+	Py_RETURN_NONE;
+}
+
+/*
+ * Common setter for the string attributes (name, uuid, attrs). Deleting
+ * the attribute or assigning None resets it.
+ */
+static int Partition_set_string(PartitionObject *self, PyObject *value,
+				int (*set)(struct fdisk_partition *, const char *),
+				const char *what)
+{
+	const char *str = NULL;
+
+	if (value && value != Py_None) {
+		if (!PyUnicode_Check(value)) {
+			PyErr_SetString(PyExc_TypeError, ARG_ERR);
+			return -1;
+		}
+		str = PyUnicode_AsUTF8(value);
+		if (!str)
+			return -1;
+	}
+	if (set(self->pa, str) < 0) {
+		PyErr_Format(PyExc_TypeError,
+			     "libfdisk reported error setting partition %s", what);
+		return -1;
+	}
+
+	return 0;
+}
+
+static PyObject *Partition_get_name(PartitionObject *self)
+{
+	return PyObjectResultStr(fdisk_partition_get_name(self->pa));
+}
+
+static int Partition_set_name(PartitionObject *self, PyObject *value, void *closure)
+{
+	return Partition_set_string(self, value, fdisk_partition_set_name, "name");
+}
+
+static PyObject *Partition_get_uuid(PartitionObject *self)
+{
+	return PyObjectResultStr(fdisk_partition_get_uuid(self->pa));
+}
+
+static int Partition_set_uuid(PartitionObject *self, PyObject *value, void *closure)
+{
+	return Partition_set_string(self, value, fdisk_partition_set_uuid, "uuid");
+}
+
+static PyObject *Partition_get_attrs(PartitionObject *self)
+{
+	return PyObjectResultStr(fdisk_partition_get_attrs(self->pa));
+}
+
+static int Partition_set_attrs(PartitionObject *self, PyObject *value, void *closure)
+{
+	return Partition_set_string(self, value, fdisk_partition_set_attrs, "attrs");
+}
+
+static PyObject *Partition_get_bootable(PartitionObject *self)
+{
+	return PyBool_FromLong(fdisk_partition_is_bootable(self->pa));
+}
+
+static PyObject *Partition_get_container(PartitionObject *self)
+{
+	return PyBool_FromLong(fdisk_partition_is_container(self->pa));
+}
+
+static PyObject *Partition_get_nested(PartitionObject *self)
+{
+	return PyBool_FromLong(fdisk_partition_is_nested(self->pa));
+}
+
+static PyObject *Partition_get_used(PartitionObject *self)
+{
+	return PyBool_FromLong(fdisk_partition_is_used(self->pa));
+}
+
+static PyObject *Partition_get_freespace(PartitionObject *self)
+{
+	return PyBool_FromLong(fdisk_partition_is_freespace(self->pa));
+}
+
+static PyObject *Partition_get_wholedisk(PartitionObject *self)
+{
+	return PyBool_FromLong(fdisk_partition_is_wholedisk(self->pa));
+}
+
+static PyObject *Partition_get_parent(PartitionObject *self)
+{
+	size_t parent;
+
+	if (fdisk_partition_is_nested(self->pa) &&
+	    fdisk_partition_get_parent(self->pa, &parent) == 0) {
+		return PyLong_FromSize_t(parent);
+	}
+	Py_RETURN_NONE;
+}
+
+/* Unlocked accessors, also used by as_tuple() and update() */
+static PyGetSetDef Partition_fields[] = {
 	{"partno",	(getter)Partition_get_partno, (setter)Partition_set_partno, "partition number", NULL},
 	{"size",	(getter)Partition_get_size, (setter)Partition_set_size, "number of sectors", NULL},
-	{"type",	(getter)Partition_get_type, (setter)Partition_set_type, "number of sectors", NULL},
+	{"type",	(getter)Partition_get_type, (setter)Partition_set_type, "partition type", NULL},
+	{"start",	(getter)Partition_get_start, (setter)Partition_set_start, "first sector", NULL},
+	{"end",		(getter)Partition_get_end, NULL, "last sector", NULL},
+	{"name",	(getter)Partition_get_name, (setter)Partition_set_name, "partition name (label specific)", NULL},
+	{"uuid",	(getter)Partition_get_uuid, (setter)Partition_set_uuid, "partition UUID (label specific)", NULL},
+	{"attrs",	(getter)Partition_get_attrs, (setter)Partition_set_attrs, "partition attributes string (label specific)", NULL},
+	{"bootable",	(getter)Partition_get_bootable, NULL, "partition is marked bootable", NULL},
+	{"container",	(getter)Partition_get_container, NULL, "partition is a container (e.g. DOS extended)", NULL},
+	{"nested",	(getter)Partition_get_nested, NULL, "partition is nested in a container", NULL},
+	{"used",	(getter)Partition_get_used, NULL, "partition is in use", NULL},
+	{"freespace",	(getter)Partition_get_freespace, NULL, "partition describes free space", NULL},
+	{"wholedisk",	(getter)Partition_get_wholedisk, NULL, "partition covers the whole disk", NULL},
+	{"parent",	(getter)Partition_get_parent, NULL, "partno of the container of a nested partition", NULL},
+	{NULL}
+};
+
+static PyGetSetDef *Partition_lookup_field(PyObject *name)
+{
+	PyGetSetDef *g;
+	const char *str;
+
+	if (!PyUnicode_Check(name)) {
+		PyErr_SetString(PyExc_TypeError, "field names must be strings");
+		return NULL;
+	}
+	str = PyUnicode_AsUTF8(name);
+	if (!str)
+		return NULL;
+
+	for (g = Partition_fields; g->name; g++) {
+		if (strcmp(g->name, str) == 0)
+			return g;
+	}
+
+	PyErr_Format(PyExc_AttributeError, "Partition has no field '%s'", str);
+	return NULL;
+}
+
+static PyObject *Partition_locked_get(PartitionObject *self, void *closure)
+{
+	PyGetSetDef *g = closure;
+	PyObject *ret;
+
+	if (Partition_lock(self) < 0)
+		return NULL;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	ret = g->get((PyObject *) self, g->closure);
+	Py_END_CRITICAL_SECTION();
+	Partition_unlock(self);
+
+	return ret;
+}
+
+static int Partition_locked_set(PartitionObject *self, PyObject *value, void *closure)
+{
+	PyGetSetDef *g = closure;
+	int ret;
+
+	if (Partition_lock(self) < 0)
+		return -1;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	ret = g->set((PyObject *) self, value, g->closure);
+	Py_END_CRITICAL_SECTION();
+	Partition_unlock(self);
+
+	return ret;
+}
+
+/* Partition_fields wrapped with the locks, filled in once */
+static PyGetSetDef Partition_getseters[sizeof(Partition_fields) / sizeof(Partition_fields[0])];
+static pthread_once_t Partition_getseters_once = PTHREAD_ONCE_INIT;
+
+static void Partition_getseters_init(void)
+{
+	size_t i;
+
+	for (i = 0; Partition_fields[i].name; i++) {
+		Partition_getseters[i].name = Partition_fields[i].name;
+		Partition_getseters[i].get = (getter) Partition_locked_get;
+		if (Partition_fields[i].set)
+			Partition_getseters[i].set = (setter) Partition_locked_set;
+		Partition_getseters[i].doc = Partition_fields[i].doc;
+		Partition_getseters[i].closure = &Partition_fields[i];
+	}
+}
+
+#define Partition_as_tuple_HELP "as_tuple(fields)\n\n" \
+	"Return a tuple with the values of the given sequence of field names, " \
+	"e.g. as_tuple(('partno', 'start', 'size', 'name'))."
+static PyObject *Partition_as_tuple(PartitionObject *self, PyObject *fields)
+{
+	PyObject *seq, *ret;
+	Py_ssize_t i, n;
+
+	seq = PySequence_Fast(fields, "fields must be a sequence of field names");
+	if (!seq)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	ret = PyTuple_New(n);
+	if (!ret)
+		goto out;
+	if (Partition_lock(self) < 0) {
+		Py_CLEAR(ret);
+		goto out;
+	}
+
+	Py_BEGIN_CRITICAL_SECTION(self);
+	for (i = 0; i < n; i++) {
+		PyGetSetDef *g = Partition_lookup_field(PySequence_Fast_GET_ITEM(seq, i));
+		PyObject *val;
+
+		if (!g || !(val = g->get((PyObject *) self, g->closure))) {
+			Py_CLEAR(ret);
+			break;
+		}
+		PyTuple_SET_ITEM(ret, i, val);
+	}
+	Py_END_CRITICAL_SECTION();
+	Partition_unlock(self);
+out:
+	Py_DECREF(seq);
+	return ret;
+}
+
+/*
+ * Check that @value can be assigned to field @g by update(), with the same
+ * conversions as its setter, so that nothing is set if any value is bad.
+ */
+static int Partition_check_field(PartitionObject *self, PyGetSetDef *g, PyObject *value)
+{
+	if (!g->set) {
+		PyErr_Format(PyExc_AttributeError, "Partition field '%s' is read-only", g->name);
+		return -1;
+	}
+	if (g->set == (setter) Partition_set_type) {
+		if (!PyObject_TypeCheck(value, get_type_state(Py_TYPE(self))->PartTypeType)) {
+			PyErr_SetString(PyExc_TypeError, value == Py_None ?
+					"partition type cannot be unset" :
+					"invalid partition type");
+			return -1;
+		}
+		return 0;
+	}
+	if (value == Py_None)
+		return 0;
+
+	if (g->set == (setter) Partition_set_partno) {
+		if (!PyLong_Check(value) ||
+		    (PyLong_AsSize_t(value) == (size_t) -1 && PyErr_Occurred()))
+			goto err;
+	} else if (g->set == (setter) Partition_set_size ||
+		   g->set == (setter) Partition_set_start) {
+		if (!PyLong_Check(value) ||
+		    (PyLong_AsUnsignedLongLong(value) == (uint64_t) -1 && PyErr_Occurred()))
+			goto err;
+	} else if (!PyUnicode_Check(value)) {
+		goto err;
+	}
+	return 0;
+err:
+	if (!PyErr_Occurred())
+		PyErr_Format(PyExc_TypeError, "Invalid type for partition field '%s'", g->name);
+	return -1;
+}
+
+#define Partition_update_HELP "update(**fields)\n\n" \
+	"Set several fields at once, e.g. update(start=2048, size=4096, name='root'). " \
+	"A value of None behaves like deleting the attribute, except for type, " \
+	"which cannot be unset. All values are checked before any is set."
+static PyObject *Partition_update(PartitionObject *self, PyObject *const *args,
+				  Py_ssize_t nargs, PyObject *kwnames)
+{
+	Py_ssize_t i, nkw = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+	int rc = 0;
+
+	if (nargs) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+
+	for (i = 0; i < nkw; i++) {
+		PyGetSetDef *g = Partition_lookup_field(PyTuple_GET_ITEM(kwnames, i));
+
+		if (!g || Partition_check_field(self, g, args[i]) < 0)
+			return NULL;
+	}
+
+	if (Partition_lock(self) < 0)
+		return NULL;
+	Py_BEGIN_CRITICAL_SECTION(self);
+	for (i = 0; i < nkw; i++) {
+		PyGetSetDef *g = Partition_lookup_field(PyTuple_GET_ITEM(kwnames, i));
+		PyObject *value = args[i];
+
+		if ((rc = g->set((PyObject *) self, value == Py_None ? NULL : value, g->closure)) < 0)
+			break;
+	}
+	Py_END_CRITICAL_SECTION();
+	Partition_unlock(self);
+	if (rc < 0)
+		return NULL;
+
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef Partition_methods[] = {
+	{"as_tuple",	(PyCFunction)Partition_as_tuple, METH_O, Partition_as_tuple_HELP},
+	{"update",	(PyCFunction)(void(*)(void))Partition_update, METH_FASTCALL | METH_KEYWORDS, Partition_update_HELP},
 	{NULL}
 };
 
 static PyObject *Partition_repr(PartitionObject *self)
 {
-	size_t partno;
+	PyObject *partno, *ret;
 
-	if (fdisk_partition_has_partno(self->pa)) {
-		partno = fdisk_partition_get_partno(self->pa);
-		return PyUnicode_FromFormat("<libfdisk.Partition object at %p, partno=%zu>",
-				self, partno);
-	}
-
-	return PyUnicode_FromFormat("<libfdisk.Partition object at %p, partno=None>",
-				    self);
-}
-
-PyTypeObject PartitionType = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "libfdisk.Partition",
-	.tp_basicsize = sizeof(PartitionObject),
-	.tp_itemsize = 0,
-	.tp_dealloc = (destructor)Partition_dealloc,
-	.tp_repr = (reprfunc) Partition_repr,
-	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-	.tp_doc = PyDoc_STR(Partition_HELP),
-	.tp_methods = Partition_methods,
-	.tp_members = Partition_members,
-	.tp_getset = Partition_getseters,
-	.tp_init = (initproc)Partition_init,
-	.tp_new = Partition_new,
+	partno = Partition_locked_get(self, &Partition_fields[0]);
+	if (!partno)
+		return NULL;
+	ret = PyUnicode_FromFormat("<libfdisk.Partition object at %p, partno=%R>",
+				   self, partno);
+	Py_DECREF(partno);
+
+	return ret;
+}
+
+static PyType_Slot Partition_slots[] = {
+	{Py_tp_dealloc, Partition_dealloc},
+	{Py_tp_repr, Partition_repr},
+	{Py_tp_doc, PyDoc_STR(Partition_HELP)},
+	{Py_tp_methods, Partition_methods},
+	{Py_tp_members, Partition_members},
+	{Py_tp_getset, Partition_getseters},
+	{Py_tp_init, Partition_init},
+	{Py_tp_new, Partition_new},
+	{0, NULL}
 };
 
-PyObject *PyObjectResultPartition(struct fdisk_partition *pa)
+static PyType_Spec Partition_spec = {
+	.name = "libfdisk.Partition",
+	.basicsize = sizeof(PartitionObject),
+	.itemsize = 0,
+	.flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE,
+	.slots = Partition_slots,
+};
+
+/* Wrap @pa, an entry of @owner's partition table (or NULL if standalone) */
+PyObject *PyObjectResultPartition(ModuleState *st, struct fdisk_partition *pa,
+				  ContextObject *owner)
 {
         PartitionObject *result;
 
@@ -222,21 +669,27 @@ PyObject *PyObjectResultPartition(struct fdisk_partition *pa)
                 return NULL;
         }
 
-        result = PyObject_New(PartitionObject, &PartitionType);
+        result = (PartitionObject *) freelist_alloc(&st->partition_freelist, st->PartitionType);
         if (!result) {
                 PyErr_SetString(PyExc_MemoryError, "Couldn't allocate Partition object");
                 return NULL;
         }
 
+        LIVE_INC(st, LIVE_PARTITION);
+        fdisk_ref_partition(pa);
         result->pa = pa;
+        result->owner = Py_XNewRef((PyObject *) owner);
         return (PyObject *) result;
 }
 
-void Partition_AddModuleObject(PyObject *mod)
+int Partition_AddModuleObject(PyObject *mod, ModuleState *st)
 {
-	if (PyType_Ready(&PartitionType) < 0)
-		return;
+	pthread_once(&Partition_getseters_once, Partition_getseters_init);
+	st->PartitionType = (PyTypeObject *) PyType_FromModuleAndSpec(mod, &Partition_spec, NULL);
+	if (!st->PartitionType)
+		return -1;
+	/* there is no Py_tp_vectorcall slot before Python 3.14 */
+	st->PartitionType->tp_vectorcall = Partition_vectorcall;
 
-	Py_INCREF(&PartitionType);
-	PyModule_AddObject(mod, "Partition", (PyObject *)&PartitionType);
+	return PyModule_AddType(mod, st->PartitionType);
 }
@@ -18,7 +18,16 @@ static PyMemberDef PartType_members[] = {
 
 static void PartType_dealloc(PartTypeObject *self)
 {
-	Py_TYPE(self)->tp_free((PyObject *) self);
+	PyTypeObject *tp = Py_TYPE(self);
+	ModuleState *st = get_type_state(tp);
+
+	/* a no-op for the static types of the label drivers */
+	fdisk_unref_parttype(self->type);
+	LIVE_DEC(st, LIVE_PARTTYPE);
+	if (!(tp == st->PartTypeType &&
+	      freelist_release(&st->parttype_freelist, (PyObject *) self)))
+		tp->tp_free((PyObject *) self);
+	Py_DECREF(tp);
 }
 
 static PyMethodDef PartType_methods[] = {
@@ -53,20 +62,26 @@ static PyObject *PartType_repr(PartTypeObject *self)
 			self, fdisk_parttype_get_name(self->type));
 }
 
-PyTypeObject PartTypeType = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	.tp_name = "libfdisk.PartType",
-	.tp_basicsize = sizeof(PartTypeObject),
-	.tp_dealloc = (destructor)PartType_dealloc,
-	.tp_repr = (reprfunc) PartType_repr,
-	.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-	/* TODO: .tp_doc = PartType_HELP, */
-	.tp_methods = PartType_methods,
-	.tp_members = PartType_members,
-	.tp_getset = PartType_getseters,
+static PyType_Slot PartType_slots[] = {
+	{Py_tp_dealloc, PartType_dealloc},
+	{Py_tp_repr, PartType_repr},
+	/* TODO: {Py_tp_doc, PartType_HELP}, */
+	{Py_tp_methods, PartType_methods},
+	{Py_tp_members, PartType_members},
+	{Py_tp_getset, PartType_getseters},
+	{0, NULL}
 };
 
-PyObject *PyObjectResultPartType(struct fdisk_parttype *t)
+/* PartType objects are only handed out by Label and Partition */
+static PyType_Spec PartType_spec = {
+	.name = "libfdisk.PartType",
+	.basicsize = sizeof(PartTypeObject),
+	.flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE |
+		 Py_TPFLAGS_DISALLOW_INSTANTIATION,
+	.slots = PartType_slots,
+};
+
+PyObject *PyObjectResultPartType(ModuleState *st, struct fdisk_parttype *t)
 {
         PartTypeObject *result;
 
@@ -75,21 +90,23 @@ PyObject *PyObjectResultPartType(struct fdisk_parttype *t)
                 return NULL;
         }
 
-        result = PyObject_New(PartTypeObject, &PartTypeType);
+        result = (PartTypeObject *) freelist_alloc(&st->parttype_freelist, st->PartTypeType);
         if (!result) {
                 PyErr_SetString(PyExc_MemoryError, "Couldn't allocate PartType object");
                 return NULL;
         }
 
+        LIVE_INC(st, LIVE_PARTTYPE);
+        fdisk_ref_parttype(t);
         result->type = t;
         return (PyObject *) result;
 }
 
-void PartType_AddModuleObject(PyObject *mod)
+int PartType_AddModuleObject(PyObject *mod, ModuleState *st)
 {
-	if (PyType_Ready(&PartTypeType) < 0)
-		return;
+	st->PartTypeType = (PyTypeObject *) PyType_FromModuleAndSpec(mod, &PartType_spec, NULL);
+	if (!st->PartTypeType)
+		return -1;
 
-	Py_INCREF(&PartTypeType);
-	PyModule_AddObject(mod, "PartType", (PyObject *)&PartTypeType);
+	return PyModule_AddType(mod, st->PartTypeType);
 }
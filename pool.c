@@ -0,0 +1,312 @@
+/*
+ * (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * Author: Jose M. Guisado <jguisado@soleta.eu>
+ */
+
+
+#include "fdisk.h"
+
+#define CONTEXTPOOL_SIZE	8
+
+typedef struct {
+	PyObject_HEAD
+	ModuleState		*st;
+	ContextObject		**idle;		/* deassigned, ready for reuse */
+	Py_ssize_t		nidle;
+	Py_ssize_t		size;
+	unsigned long		hits;
+	unsigned long		misses;
+	pthread_mutex_t		lock;
+} ContextPoolObject;
+
+static void ContextPool_dealloc(ContextPoolObject *self)
+{
+	PyTypeObject *tp = Py_TYPE(self);
+	Py_ssize_t i;
+
+	for (i = 0; i < self->nidle; i++)
+		Py_DECREF(self->idle[i]);
+	PyMem_Free(self->idle);
+	pthread_mutex_destroy(&self->lock);
+	tp->tp_free((PyObject *) self);
+	Py_DECREF(tp);
+}
+
+#define ContextPool_HELP "ContextPool(size=8)\n\n" \
+	"Keeps up to size idle Contexts so scanning many devices reuses the " \
+	"same libfdisk contexts, partition tables and iterators. Use " \
+	"acquire() to get a Context assigned to a device and release() to " \
+	"give it back; methods of a released Context raise RuntimeError."
+static PyObject *ContextPool_alloc(PyTypeObject *type, Py_ssize_t size)
+{
+	ContextPoolObject *self;
+
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "size must not be negative");
+		return NULL;
+	}
+
+	self = (ContextPoolObject *) type->tp_alloc(type, 0);
+	if (!self)
+		return NULL;
+
+	self->st = get_type_state(type);
+	self->nidle = 0;
+	self->size = size;
+	self->hits = self->misses = 0;
+	pthread_mutex_init(&self->lock, NULL);
+	self->idle = PyMem_Calloc(size ? size : 1, sizeof(*self->idle));
+	if (!self->idle) {
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+
+	return (PyObject *) self;
+}
+
+static PyObject *ContextPool_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "size", NULL };
+	Py_ssize_t size = CONTEXTPOOL_SIZE;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n", kwlist, &size))
+		return NULL;
+
+	return ContextPool_alloc(type, size);
+}
+
+/* Fast path for ContextPool(...), subclasses go through tp_new */
+static PyObject *ContextPool_vectorcall(PyObject *type, PyObject *const *args,
+					size_t nargsf, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "size", NULL };
+	Py_ssize_t size = CONTEXTPOOL_SIZE;
+	PyObject *argv[1] = { NULL };
+
+	if ((PyTypeObject *) type != get_type_state((PyTypeObject *) type)->ContextPoolType)
+		return vectorcall_type_call(type, args, nargsf, kwnames);
+
+	if (unpack_fastcall_args(args, PyVectorcall_NARGS(nargsf), kwnames,
+				 kwlist, 1, 0, argv) < 0)
+		return NULL;
+	if (argv[0] && (size = PyNumber_AsSsize_t(argv[0], PyExc_OverflowError)) == -1 &&
+	    PyErr_Occurred())
+		return NULL;
+
+	return ContextPool_alloc((PyTypeObject *) type, size);
+}
+
+/* Take an idle context, or NULL if there is none. Never fails. */
+static ContextObject *ContextPool_pop(ContextPoolObject *self)
+{
+	ContextObject *cxt = NULL;
+
+	pthread_mutex_lock(&self->lock);
+	if (self->nidle) {
+		cxt = self->idle[--self->nidle];
+		self->hits++;
+	} else {
+		self->misses++;
+	}
+	pthread_mutex_unlock(&self->lock);
+
+	return cxt;
+}
+
+/* Keep a reference to @cxt if there is room */
+static void ContextPool_push(ContextPoolObject *self, ContextObject *cxt)
+{
+	pthread_mutex_lock(&self->lock);
+	if (self->nidle < self->size) {
+		Py_INCREF(cxt);
+		self->idle[self->nidle++] = cxt;
+	}
+	pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * Move the libfdisk state of @cxt, already without a device, to @spare and
+ * forget the settings of its user, so that the next acquire() hands out an
+ * object nobody else holds.
+ */
+static void ContextPool_take(ContextObject *cxt, ContextObject *spare)
+{
+	answers_free(cxt->answers);
+	cxt->answers = NULL;
+	fdisk_set_size_unit(cxt->cxt, FDISK_SIZEUNIT_HUMAN);
+	fdisk_set_ask(cxt->cxt, Context_ask_cb, spare);
+
+	spare->cxt = cxt->cxt;
+	spare->tb = cxt->tb;
+	spare->itr = cxt->itr;
+	spare->wipes = cxt->wipes;
+	cxt->cxt = NULL;
+	cxt->tb = NULL;
+	cxt->itr = NULL;
+	cxt->wipes = NULL;
+	cxt->released = 1;
+}
+
+#define ContextPool_acquire_HELP "acquire(device, readonly=False, details=True)\n\n" \
+	"Returns a Context assigned to device, recycling an idle one if any."
+static PyObject *ContextPool_acquire(ContextPoolObject *self, PyObject *const *args,
+				     Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "device", "readonly", "details", NULL };
+	PyObject *argv[3] = { NULL, NULL, NULL };
+	int rc, details = 1, readonly = 0;
+	const char *device;
+	ContextObject *cxt;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 3, 1, argv) < 0)
+		return NULL;
+	if (!(device = PyUnicode_AsUTF8(argv[0]))) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	if (argv[1] && (readonly = PyObject_IsTrue(argv[1])) < 0)
+		return NULL;
+	if (argv[2] && (details = PyObject_IsTrue(argv[2])) < 0)
+		return NULL;
+
+	cxt = ContextPool_pop(self);
+	if (!cxt && !(cxt = Context_alloc(self->st->ContextType)))
+		return NULL;
+
+	if (Context_lock(cxt) < 0) {
+		Py_DECREF(cxt);
+		return NULL;
+	}
+	rc = Context_setup(cxt, device, details, readonly);
+	Context_unlock(cxt);
+	log_flush_pending(self->st);
+
+	if (rc < 0) {
+		/* still reusable if only the device was the problem */
+		if (cxt->cxt)
+			ContextPool_push(self, cxt);
+		Py_DECREF(cxt);
+		return NULL;
+	}
+
+	return (PyObject *) cxt;
+}
+
+#define ContextPool_release_HELP "release(context, nosync=False)\n\n" \
+	"Deassign the context's device (see Context.deassign()) and keep its " \
+	"libfdisk state for a later acquire() if the pool is not full. The " \
+	"context's methods raise RuntimeError from now on; acquire() returns " \
+	"a new Context object, without the set_answers() and size_unit of " \
+	"this one."
+static PyObject *ContextPool_release(ContextPoolObject *self, PyObject *const *args,
+				     Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "", "nosync", NULL };
+	PyObject *argv[2] = { NULL, NULL };
+	ContextObject *cxt, *spare;
+	int rc = 0, nosync = 0;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 2, 1, argv) < 0)
+		return NULL;
+	if (!PyObject_TypeCheck(argv[0], self->st->ContextType)) {
+		PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+	if (argv[1] && (nosync = PyObject_IsTrue(argv[1])) < 0)
+		return NULL;
+	cxt = (ContextObject *) argv[0];
+
+	if (Context_check_device(cxt) < 0)
+		return NULL;
+	/* before deassigning, nothing to undo if this fails */
+	if (!(spare = Context_alloc(self->st->ContextType)))
+		return NULL;
+	if (Context_lock(cxt) < 0) {
+		Py_DECREF(spare);
+		return NULL;
+	}
+	if (cxt->released)
+		rc = -EALREADY;
+	else if (cxt->cxt)
+		rc = Context_release_device(cxt, nosync);
+	if (!rc && cxt->cxt)
+		ContextPool_take(cxt, spare);
+	else if (!rc)
+		cxt->released = 1;
+	Context_unlock(cxt);
+	log_flush_pending(self->st);
+
+	if (rc == -EALREADY) {
+		PyErr_SetString(PyExc_ValueError, "Context already released");
+	} else if (rc < 0) {
+		set_PyErr_from_rc(-rc);
+	} else if (spare->cxt) {
+		ContextPool_push(self, spare);
+	}
+	Py_DECREF(spare);
+	if (rc < 0)
+		return NULL;
+
+	Py_RETURN_NONE;
+}
+
+#define ContextPool_stats_HELP "stats()\n\n" \
+	"Returns a dict with the pool size, the number of idle contexts and " \
+	"how many acquire() calls reused one (hits) or allocated one (misses)."
+static PyObject *ContextPool_stats(ContextPoolObject *self, PyObject *Py_UNUSED(ignored))
+{
+	PyObject *ret;
+
+	pthread_mutex_lock(&self->lock);
+	ret = Py_BuildValue("{s:n,s:n,s:k,s:k}", "size", self->size, "idle", self->nidle,
+			    "hits", self->hits, "misses", self->misses);
+	pthread_mutex_unlock(&self->lock);
+
+	return ret;
+}
+
+static PyMethodDef ContextPool_methods[] = {
+	{"acquire",	(PyCFunction)(void(*)(void))ContextPool_acquire, METH_FASTCALL | METH_KEYWORDS, ContextPool_acquire_HELP},
+	{"release",	(PyCFunction)(void(*)(void))ContextPool_release, METH_FASTCALL | METH_KEYWORDS, ContextPool_release_HELP},
+	{"stats",	(PyCFunction)ContextPool_stats, METH_NOARGS, ContextPool_stats_HELP},
+	{NULL}
+};
+
+static PyObject *ContextPool_repr(ContextPoolObject *self)
+{
+	return PyUnicode_FromFormat("<libfdisk.ContextPool object at %p, size=%zd, idle=%zd>",
+				    self, self->size, self->nidle);
+}
+
+static PyType_Slot ContextPool_slots[] = {
+	{Py_tp_dealloc, ContextPool_dealloc},
+	{Py_tp_repr, ContextPool_repr},
+	{Py_tp_doc, ContextPool_HELP},
+	{Py_tp_methods, ContextPool_methods},
+	{Py_tp_new, ContextPool_new},
+	{0, NULL}
+};
+
+static PyType_Spec ContextPool_spec = {
+	.name = "libfdisk.ContextPool",
+	.basicsize = sizeof(ContextPoolObject),
+	.flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE,
+	.slots = ContextPool_slots,
+};
+
+int ContextPool_AddModuleObject(PyObject *mod, ModuleState *st)
+{
+	st->ContextPoolType = (PyTypeObject *) PyType_FromModuleAndSpec(mod, &ContextPool_spec, NULL);
+	if (!st->ContextPoolType)
+		return -1;
+	/* there is no Py_tp_vectorcall slot before Python 3.14 */
+	st->ContextPoolType->tp_vectorcall = ContextPool_vectorcall;
+
+	return PyModule_AddType(mod, st->ContextPoolType);
+}
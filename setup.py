@@ -1,11 +1,24 @@
+import os
+import sysconfig
+
 from setuptools import setup, Extension
 
+def have_header(name):
+    dirs = ['/usr/include', '/usr/local/include', sysconfig.get_config_var('INCLUDEDIR')]
+    return any(d and os.path.exists(os.path.join(d, name)) for d in dirs)
+
+# USDT probes, see fdisk.h
+macros = [('HAVE_SYS_SDT_H', '1')] if have_header('sys/sdt.h') else []
+
 libfdisk = Extension('fdisk',
                     libraries = ['fdisk'],
+                    define_macros = macros,
                     sources = ['fdisk.c', 'context.c', 'label.c',
-                               'partition.c', 'parttype.c'])
+                               'partition.c', 'parttype.c', 'stats.c',
+                               'ask.c', 'wipe.c', 'verify.c', 'pool.c'])
 
 setup (name = 'libfdisk',
        version = '1.2',
        description = 'Python bindings for libfdisk',
+       python_requires = '>=3.11',
        ext_modules = [libfdisk])
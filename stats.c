@@ -0,0 +1,269 @@
+/*
+ * (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * Author: Jose M. Guisado <jguisado@soleta.eu>
+ */
+
+
+#include <time.h>
+
+#include "fdisk.h"
+
+/*
+ * Per-operation call/error counters and log2 latency histograms.
+ *
+ * Every thread records into its own struct thread_stats, so the hot path is
+ * a handful of single-writer relaxed stores without locks or atomics RMW.
+ * Readers sum all live threads plus the counters of exited threads under
+ * stats_lock. Resetting does not touch the per-thread counters (that would
+ * race with their owners); it snapshots the current totals as a baseline
+ * that is subtracted on read.
+ *
+ * The counters are process wide: they describe libfdisk usage regardless
+ * of the interpreter that issued the calls.
+ */
+
+struct op_stats {
+	uint64_t	calls;
+	uint64_t	errors;
+	uint64_t	total_ns;
+	uint64_t	hist[STATS_NBUCKETS];	/* [2^i, 2^(i+1)) ns */
+};
+
+struct thread_stats {
+	struct op_stats		ops[STAT_NOPS];
+	struct thread_stats	*next;
+};
+
+static const char *stats_names[STAT_NOPS] = {
+	[STAT_ASSIGN_DEVICE]	= "assign_device",
+	[STAT_GET_PARTITIONS]	= "get_partitions",
+	[STAT_WRITE_DISKLABEL]	= "write_disklabel",
+	[STAT_ADD_PARTITION]	= "add_partition",
+	[STAT_WIPE]		= "wipe",
+	[STAT_PARTTYPE_LOOKUP]	= "parttype_lookup",
+	[STAT_VERIFY]		= "verify",
+};
+
+int stats_enabled_flag;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static struct thread_stats *stats_threads;	/* live threads */
+static struct op_stats stats_retired[STAT_NOPS];	/* exited threads */
+static struct op_stats stats_baseline[STAT_NOPS];	/* at last reset */
+static __thread struct thread_stats *stats_self;
+
+#define STAT_LOAD(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STAT_ADD(x, n)		__atomic_store_n(&(x), STAT_LOAD(x) + (n), __ATOMIC_RELAXED)
+
+static void op_stats_add(struct op_stats *dst, struct op_stats *src)
+{
+	int i;
+
+	dst->calls += STAT_LOAD(src->calls);
+	dst->errors += STAT_LOAD(src->errors);
+	dst->total_ns += STAT_LOAD(src->total_ns);
+	for (i = 0; i < STATS_NBUCKETS; i++)
+		dst->hist[i] += STAT_LOAD(src->hist[i]);
+}
+
+/* Fold the counters of an exiting thread into stats_retired */
+static void stats_thread_exit(void *data)
+{
+	struct thread_stats *ts = data, **pp;
+	int op;
+
+	pthread_mutex_lock(&stats_lock);
+	for (pp = &stats_threads; *pp; pp = &(*pp)->next) {
+		if (*pp == ts) {
+			*pp = ts->next;
+			break;
+		}
+	}
+	for (op = 0; op < STAT_NOPS; op++)
+		op_stats_add(&stats_retired[op], &ts->ops[op]);
+	pthread_mutex_unlock(&stats_lock);
+
+	free(ts);
+}
+
+static void stats_init_key(void)
+{
+	pthread_key_create(&stats_key, stats_thread_exit);
+}
+
+static struct thread_stats *stats_thread(void)
+{
+	struct thread_stats *ts = stats_self;
+
+	if (ts)
+		return ts;
+
+	ts = calloc(1, sizeof(*ts));
+	if (!ts)
+		return NULL;
+
+	pthread_once(&stats_once, stats_init_key);
+	pthread_setspecific(stats_key, ts);
+
+	pthread_mutex_lock(&stats_lock);
+	ts->next = stats_threads;
+	stats_threads = ts;
+	pthread_mutex_unlock(&stats_lock);
+
+	return stats_self = ts;
+}
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_record(int op, uint64_t start, int rc)
+{
+	struct thread_stats *ts = stats_thread();
+	uint64_t ns = stats_now() - start;
+	struct op_stats *s;
+	int bucket;
+
+	if (!ts)
+		return;
+
+	s = &ts->ops[op];
+	bucket = 63 - __builtin_clzll(ns | 1);
+	if (bucket >= STATS_NBUCKETS)
+		bucket = STATS_NBUCKETS - 1;
+
+	STAT_ADD(s->calls, 1);
+	if (rc < 0)
+		STAT_ADD(s->errors, 1);
+	STAT_ADD(s->total_ns, ns);
+	STAT_ADD(s->hist[bucket], 1);
+}
+
+/* Current totals of all threads, without the baseline. Needs stats_lock. */
+static void stats_collect(struct op_stats *out)
+{
+	struct thread_stats *ts;
+	int op;
+
+	memcpy(out, stats_retired, sizeof(stats_retired));
+	for (ts = stats_threads; ts; ts = ts->next) {
+		for (op = 0; op < STAT_NOPS; op++)
+			op_stats_add(&out[op], &ts->ops[op]);
+	}
+}
+
+static PyObject *op_stats_to_dict(struct op_stats *s, struct op_stats *base)
+{
+	PyObject *ret, *hist, *val;
+	int i;
+
+	hist = PyDict_New();
+	if (!hist)
+		return NULL;
+
+	for (i = 0; i < STATS_NBUCKETS; i++) {
+		uint64_t n = s->hist[i] - base->hist[i];
+		PyObject *key;
+
+		if (!n)
+			continue;
+		key = PyLong_FromUnsignedLongLong(1ULL << i);
+		val = PyLong_FromUnsignedLongLong(n);
+		if (!key || !val || PyDict_SetItem(hist, key, val) < 0) {
+			Py_XDECREF(key);
+			Py_XDECREF(val);
+			Py_DECREF(hist);
+			return NULL;
+		}
+		Py_DECREF(key);
+		Py_DECREF(val);
+	}
+
+	ret = Py_BuildValue("{s:K,s:K,s:K,s:N}",
+			    "calls", s->calls - base->calls,
+			    "errors", s->errors - base->errors,
+			    "total_ns", s->total_ns - base->total_ns,
+			    "histogram", hist);
+	return ret;
+}
+
+#define Fdisk_stats_HELP "stats()\n\n" \
+	"Return a dict mapping each instrumented libfdisk operation to its " \
+	"'calls', 'errors', 'total_ns' and 'histogram' since the last " \
+	"reset_stats(). The histogram maps the lower bound in ns of each " \
+	"non-empty log2 latency bucket to its count. Collection is off until " \
+	"enable_stats(True) is called."
+static PyObject *Fdisk_stats(PyObject *mod, PyObject *Py_UNUSED(ignored))
+{
+	struct op_stats cur[STAT_NOPS], base[STAT_NOPS];
+	PyObject *ret, *val;
+	int op;
+
+	pthread_mutex_lock(&stats_lock);
+	stats_collect(cur);
+	memcpy(base, stats_baseline, sizeof(base));
+	pthread_mutex_unlock(&stats_lock);
+
+	ret = PyDict_New();
+	if (!ret)
+		return NULL;
+
+	for (op = 0; op < STAT_NOPS; op++) {
+		val = op_stats_to_dict(&cur[op], &base[op]);
+		if (!val || PyDict_SetItemString(ret, stats_names[op], val) < 0) {
+			Py_XDECREF(val);
+			Py_DECREF(ret);
+			return NULL;
+		}
+		Py_DECREF(val);
+	}
+
+	return ret;
+}
+
+#define Fdisk_reset_stats_HELP "reset_stats()\n\n" \
+	"Zero the counters reported by stats()."
+static PyObject *Fdisk_reset_stats(PyObject *mod, PyObject *Py_UNUSED(ignored))
+{
+	pthread_mutex_lock(&stats_lock);
+	stats_collect(stats_baseline);
+	pthread_mutex_unlock(&stats_lock);
+
+	Py_RETURN_NONE;
+}
+
+#define Fdisk_enable_stats_HELP "enable_stats(enable=True)\n\n" \
+	"Turn collection of the counters reported by stats() on or off. " \
+	"Returns the previous setting."
+static PyObject *Fdisk_enable_stats(PyObject *mod, PyObject *const *args, Py_ssize_t nargs)
+{
+	int enable = 1, old;
+
+	if (nargs > 1 || (nargs == 1 && (enable = PyObject_IsTrue(args[0])) < 0)) {
+		if (!PyErr_Occurred())
+			PyErr_SetString(PyExc_TypeError, ARG_ERR);
+		return NULL;
+	}
+
+	old = __atomic_exchange_n(&stats_enabled_flag, enable, __ATOMIC_RELAXED);
+	return PyBool_FromLong(old);
+}
+
+PyMethodDef Stats_methods[] = {
+	{"stats",	(PyCFunction)Fdisk_stats, METH_NOARGS, Fdisk_stats_HELP},
+	{"reset_stats",	(PyCFunction)Fdisk_reset_stats, METH_NOARGS, Fdisk_reset_stats_HELP},
+	{"enable_stats",	(PyCFunction)(void(*)(void))Fdisk_enable_stats, METH_FASTCALL, Fdisk_enable_stats_HELP},
+	{NULL}
+};
@@ -0,0 +1,376 @@
+/*
+ * (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * Author: Jose M. Guisado <jguisado@soleta.eu>
+ */
+
+
+#include "fdisk.h"
+
+#define VERIFY_WORKERS	4
+
+static const char *verify_kinds[] = {
+	[VERIFY_OVERLAP]	= "overlap",
+	[VERIFY_ALIGNMENT]	= "alignment",
+	[VERIFY_CHECKSUM]	= "checksum",
+	[VERIFY_RANGE]		= "range",
+	[VERIFY_OTHER]		= "other",
+};
+
+/*
+ * libfdisk only reports verification problems as text, so they are
+ * classified by the (untranslated) messages of the DOS and GPT drivers.
+ * Anything not listed here, or translated, ends up as VERIFY_OTHER.
+ * First match wins; -1 drops the "N errors detected" summary.
+ */
+static const struct {
+	const char	*pattern;
+	int		kind;
+} verify_patterns[] = {
+	{ "error detected",		-1 },
+	{ "errors detected",		-1 },
+	{ "overlap",			VERIFY_OVERLAP },
+	{ "not entirely in",		VERIFY_OVERLAP },
+	{ "boundary",			VERIFY_ALIGNMENT },
+	{ "align",			VERIFY_ALIGNMENT },
+	{ "checksum",			VERIFY_CHECKSUM },
+	{ "header mismatch",		VERIFY_CHECKSUM },
+	{ "table is corrupt",		VERIFY_CHECKSUM },
+	{ "valid backup header",	VERIFY_CHECKSUM },
+	{ "sanity check",		VERIFY_RANGE },
+	{ "MyLBA",			VERIFY_RANGE },
+	{ "too big",			VERIFY_RANGE },
+	{ "too small",			VERIFY_RANGE },
+	{ "greater than",		VERIFY_RANGE },
+	{ "ends before",		VERIFY_RANGE },
+	{ "contains sector 0",		VERIFY_RANGE },
+	{ "start-of-data",		VERIFY_RANGE },
+	{ "disagrees",			VERIFY_RANGE },
+	{ "size mismatch",		VERIFY_RANGE },
+};
+
+static int verify_classify(const char *msg)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(verify_patterns) / sizeof(verify_patterns[0]); i++) {
+		if (strcasestr(msg, verify_patterns[i].pattern))
+			return verify_patterns[i].kind;
+	}
+	return VERIFY_OTHER;
+}
+
+/* First partition number in @msg, 0-based like Partition.partno, or -1 */
+static long verify_partno(const char *msg)
+{
+	const char *p = strcasestr(msg, "partition");
+	unsigned long n;
+	char *end;
+
+	if (!p)
+		return -1;
+	p += strlen("partition");
+	if (*p == 's')
+		p++;
+	n = strtoul(p, &end, 10);
+	if (end == p || n == 0)
+		return -1;
+	return (long) n - 1;
+}
+
+static void verify_add(struct verify_sink *sink, int kind, long partno,
+		       const char *msg, int err)
+{
+	struct verify_problem *p;
+
+	if (sink->n == sink->alloc) {
+		size_t alloc = sink->alloc ? sink->alloc * 2 : 8;
+
+		p = realloc(sink->items, alloc * sizeof(*p));
+		if (!p)
+			return;	/* losing a message beats failing the check */
+		sink->items = p;
+		sink->alloc = alloc;
+	}
+	p = &sink->items[sink->n++];
+	p->kind = kind;
+	p->partno = partno;
+	if (err)
+		snprintf(p->msg, sizeof(p->msg), "%s: %s", msg, strerror(err));
+	else
+		snprintf(p->msg, sizeof(p->msg), "%s", msg);
+}
+
+/*
+ * Dialog handler collecting warnings into the sink given as @data.
+ * Everything else goes to the handler of sink->chain, so fdisk_info()
+ * output still reaches the logger; warnings too if sink->forward is set.
+ */
+int verify_ask_cb(struct fdisk_context *cxt, struct fdisk_ask *ask, void *data)
+{
+	struct verify_sink *sink = data;
+	const char *msg;
+	int kind;
+
+	switch (fdisk_ask_get_type(ask)) {
+	case FDISK_ASKTYPE_WARN:
+	case FDISK_ASKTYPE_WARNX:
+		msg = fdisk_ask_print_get_mesg(ask);
+		if (msg && (kind = verify_classify(msg)) >= 0)
+			verify_add(sink, kind, verify_partno(msg), msg,
+				   fdisk_ask_get_type(ask) == FDISK_ASKTYPE_WARN ?
+				   fdisk_ask_print_get_errno(ask) : 0);
+		return sink->chain && sink->forward ? Context_ask_cb(cxt, ask, sink->chain) : 0;
+	case FDISK_ASKTYPE_INFO:
+		return sink->chain ? Context_ask_cb(cxt, ask, sink->chain) : 0;
+	default:
+		return sink->chain ? Context_ask_cb(cxt, ask, sink->chain) : -EINVAL;
+	}
+}
+
+/* libfdisk does not check this itself, fdisk(8) warns when listing */
+static void verify_alignment(struct fdisk_context *cxt, struct verify_sink *sink)
+{
+	struct fdisk_table *tb = NULL;
+	struct fdisk_partition *pa;
+	struct fdisk_iter *itr;
+	char msg[LOG_MSG_MAX];
+
+	if (fdisk_get_partitions(cxt, &tb) < 0)
+		return;
+	itr = fdisk_new_iter(FDISK_ITER_FORWARD);
+	while (itr && fdisk_table_next_partition(tb, itr, &pa) == 0) {
+		if (fdisk_partition_is_container(pa) ||
+		    !fdisk_partition_has_start(pa) ||
+		    fdisk_lba_is_phy_aligned(cxt, fdisk_partition_get_start(pa)))
+			continue;
+		snprintf(msg, sizeof(msg),
+			 "Partition %zu does not start on physical sector boundary.",
+			 fdisk_partition_get_partno(pa) + 1);
+		verify_add(sink, VERIFY_ALIGNMENT, fdisk_partition_get_partno(pa), msg, 0);
+	}
+	fdisk_free_iter(itr);
+	fdisk_unref_table(tb);
+}
+
+/*
+ * Verify the label of @cxt, collecting the problems into @sink instead of
+ * printing them. Does not need the GIL unless sink->chain is set. Leaves
+ * verify_ask_cb() installed, callers reinstall their own dialog handler.
+ * Returns fdisk_verify_disklabel()'s result.
+ */
+int verify_context(struct fdisk_context *cxt, struct verify_sink *sink)
+{
+	uint64_t t0;
+	int rc;
+
+	fdisk_set_ask(cxt, verify_ask_cb, sink);
+
+	t0 = STATS_BEGIN();
+	USDT_PROBE(verify_entry, fdisk_get_devname(cxt), -1, 0);
+	rc = fdisk_verify_disklabel(cxt);
+	USDT_PROBE(verify_return, fdisk_get_devname(cxt), -1, rc);
+	STATS_END(STAT_VERIFY, t0, rc);
+
+	if (rc >= 0)
+		verify_alignment(cxt, sink);
+	return rc;
+}
+
+void verify_sink_free(struct verify_sink *sink)
+{
+	free(sink->items);
+	sink->items = NULL;
+	sink->n = sink->alloc = 0;
+}
+
+PyObject *verify_sink_to_list(struct verify_sink *sink)
+{
+	PyObject *list, *item;
+	size_t i;
+
+	list = PyList_New(sink->n);
+	if (!list)
+		return NULL;
+
+	for (i = 0; i < sink->n; i++) {
+		struct verify_problem *p = &sink->items[i];
+
+		if (p->partno < 0)
+			item = Py_BuildValue("{s:s,s:O,s:s}", "kind", verify_kinds[p->kind],
+					     "partno", Py_None, "message", p->msg);
+		else
+			item = Py_BuildValue("{s:s,s:l,s:s}", "kind", verify_kinds[p->kind],
+					     "partno", p->partno, "message", p->msg);
+		if (!item) {
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+
+	return list;
+}
+
+struct verify_job {
+	char			*path;
+	int			rc;
+	struct verify_sink	sink;
+};
+
+struct verify_pool {
+	struct verify_job	*jobs;
+	size_t			njobs;
+	size_t			next;
+};
+
+static void verify_job_run(struct verify_job *job)
+{
+	struct fdisk_context *cxt = fdisk_new_context();
+
+	if (!cxt) {
+		job->rc = -ENOMEM;
+		return;
+	}
+	/* warnings while probing the label are problems too */
+	fdisk_set_ask(cxt, verify_ask_cb, &job->sink);
+	job->rc = fdisk_assign_device(cxt, job->path, 1);
+	if (job->rc == 0)
+		job->rc = verify_context(cxt, &job->sink);
+	fdisk_unref_context(cxt);
+}
+
+static void *verify_worker(void *data)
+{
+	struct verify_pool *pool = data;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->njobs)
+		verify_job_run(&pool->jobs[i]);
+
+	return NULL;
+}
+
+static PyObject *verify_job_result(PyObject *device, struct verify_job *job)
+{
+	PyObject *problems, *error;
+
+	problems = verify_sink_to_list(&job->sink);
+	if (!problems)
+		return NULL;
+	if (job->rc < 0) {
+		error = PyObject_CallFunction(PyExc_OSError, "isO", -job->rc,
+					      strerror(-job->rc), device);
+		if (!error) {
+			Py_DECREF(problems);
+			return NULL;
+		}
+	} else {
+		error = Py_NewRef(Py_None);
+	}
+
+	return Py_BuildValue("{s:O,s:N,s:N}", "device", device,
+			     "error", error, "problems", problems);
+}
+
+#define Fdisk_verify_many_HELP "verify_many(devices, workers=4)\n\n" \
+	"Verify the disklabel of every device (opened read-only) on up to " \
+	"workers threads, without holding the GIL. Returns, in the order " \
+	"given, a list of dicts with keys 'device', 'error' (an OSError if " \
+	"the device could not be opened or has no label, else None) and " \
+	"'problems' (as returned by Context.verify())."
+static PyObject *Fdisk_verify_many(PyObject *mod, PyObject *const *args,
+				   Py_ssize_t nargs, PyObject *kwnames)
+{
+	static const char * const kwlist[] = { "devices", "workers", NULL };
+	PyObject *argv[2] = { NULL, NULL }, *seq, *ret = NULL, *bytes, *item;
+	struct verify_pool pool = { NULL, 0, 0 };
+	pthread_t *threads = NULL;
+	long i, workers = VERIFY_WORKERS, nthreads = 0;
+
+	if (unpack_fastcall_args(args, nargs, kwnames, kwlist, 2, 1, argv) < 0)
+		return NULL;
+	if (argv[1] && (workers = PyLong_AsLong(argv[1])) == -1 && PyErr_Occurred())
+		return NULL;
+	if (workers < 1) {
+		PyErr_SetString(PyExc_ValueError, "workers must be at least 1");
+		return NULL;
+	}
+
+	/* a single path would otherwise be verified one character at a time */
+	if (PyUnicode_Check(argv[0]) || PyBytes_Check(argv[0]) || PyByteArray_Check(argv[0])) {
+		PyErr_SetString(PyExc_TypeError, "devices must be a sequence of paths, not a path");
+		return NULL;
+	}
+	seq = PySequence_Fast(argv[0], "devices must be iterable");
+	if (!seq)
+		return NULL;
+
+	pool.njobs = PySequence_Fast_GET_SIZE(seq);
+	pool.jobs = calloc(pool.njobs ? pool.njobs : 1, sizeof(*pool.jobs));
+	if (!pool.jobs) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (i = 0; i < (long) pool.njobs; i++) {
+		if (!PyUnicode_FSConverter(PySequence_Fast_GET_ITEM(seq, i), &bytes))
+			goto out;
+		pool.jobs[i].path = strdup(PyBytes_AS_STRING(bytes));
+		Py_DECREF(bytes);
+		if (!pool.jobs[i].path) {
+			PyErr_NoMemory();
+			goto out;
+		}
+	}
+
+	if (workers > (long) pool.njobs)
+		workers = pool.njobs;
+	threads = calloc(workers ? workers : 1, sizeof(*threads));
+	if (!threads) {
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	for (nthreads = 0; nthreads < workers - 1; nthreads++) {
+		if (pthread_create(&threads[nthreads], NULL, verify_worker, &pool) != 0)
+			break;
+	}
+	/* this thread is the last worker */
+	verify_worker(&pool);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	Py_END_ALLOW_THREADS
+
+	ret = PyList_New(pool.njobs);
+	if (!ret)
+		goto out;
+	for (i = 0; i < (long) pool.njobs; i++) {
+		item = verify_job_result(PySequence_Fast_GET_ITEM(seq, i), &pool.jobs[i]);
+		if (!item) {
+			Py_CLEAR(ret);
+			goto out;
+		}
+		PyList_SET_ITEM(ret, i, item);
+	}
+
+out:
+	for (i = 0; pool.jobs && i < (long) pool.njobs; i++) {
+		free(pool.jobs[i].path);
+		verify_sink_free(&pool.jobs[i].sink);
+	}
+	free(pool.jobs);
+	free(threads);
+	Py_DECREF(seq);
+	return ret;
+}
+
+PyMethodDef Verify_methods[] = {
+	{"verify_many",	(PyCFunction)(void(*)(void))Fdisk_verify_many, METH_FASTCALL | METH_KEYWORDS, Fdisk_verify_many_HELP},
+	{NULL}
+};
@@ -0,0 +1,77 @@
+/*
+ * (C) 2022 Soleta Consulting S.L. <info@soleta.eu>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * Author: Jose M. Guisado <jguisado@soleta.eu>
+ */
+
+
+#include "fdisk.h"
+
+/* after Python.h, which defines _GNU_SOURCE for fallocate() */
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+
+static const char *wipe_names[] = {
+	[WIPE_NONE]		= "none",
+	[WIPE_SIGNATURES]	= "signatures",
+	[WIPE_DISCARD]		= "discard",
+	[WIPE_ZEROOUT]		= "zeroout",
+};
+
+/*
+ * Convert a wipe= argument to a WIPE_* mode. Returns -1 with an exception
+ * set if @obj is not one of the mode names.
+ */
+int wipe_mode_from_object(PyObject *obj, int *mode)
+{
+	const char *str;
+	size_t i;
+
+	if (!PyUnicode_Check(obj) || !(str = PyUnicode_AsUTF8(obj)))
+		goto err;
+
+	for (i = 0; i < sizeof(wipe_names) / sizeof(wipe_names[0]); i++) {
+		if (strcmp(wipe_names[i], str) == 0) {
+			*mode = i;
+			return 0;
+		}
+	}
+err:
+	PyErr_SetString(PyExc_ValueError,
+			"wipe must be one of 'signatures', 'discard', 'zeroout' or 'none'");
+	return -1;
+}
+
+/*
+ * Discard or zero @len bytes at @offset of @fd, without touching the GIL.
+ * Block devices use BLKDISCARD/BLKZEROOUT. Image files get the equivalent
+ * fallocate() hole punching, or zero range, falling back to hole punching
+ * on filesystems that cannot zero ranges. Returns 0 or -errno.
+ */
+int wipe_range(int fd, int regfile, int mode, uint64_t offset, uint64_t len)
+{
+	uint64_t range[2] = { offset, len };
+	int rc;
+
+	if (regfile) {
+		if (mode == WIPE_ZEROOUT) {
+			rc = fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+				       offset, len);
+			if (rc == 0 || errno != EOPNOTSUPP)
+				return rc ? -errno : 0;
+		}
+		rc = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			       offset, len);
+	} else {
+		rc = ioctl(fd, mode == WIPE_ZEROOUT ? BLKZEROOUT : BLKDISCARD, range);
+	}
+
+	return rc ? -errno : 0;
+}